@@ -0,0 +1,91 @@
+//
+//  IndigoClock.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoClock.h"
+
+#pragma mark - Steady clock
+
+long long CSteadyClock::nowMs()
+{
+    return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void CSteadyClock::sleepMs(int nMs)
+{
+    if(nMs > 0)
+        std::this_thread::sleep_for(std::chrono::milliseconds(nMs));
+}
+
+
+#pragma mark - Host clock
+
+CHostClock::CHostClock(SleeperInterface *pSleeper, TickCountInterface *pTickCount)
+{
+    m_bTickValid = false;
+    m_nLastTick = 0;
+    m_llTickBase = 0;
+    setInterfaces(pSleeper, pTickCount);
+}
+
+void CHostClock::setInterfaces(SleeperInterface *pSleeper, TickCountInterface *pTickCount)
+{
+    std::lock_guard<std::mutex> lock(m_ClockMutex);
+    m_pSleeper = pSleeper;
+    m_pTickCount = pTickCount;
+    m_bTickValid = false;
+}
+
+long long CHostClock::nowMs()
+{
+    int nTick;
+
+    std::lock_guard<std::mutex> lock(m_ClockMutex);
+    if(!m_pTickCount)
+        return m_SteadyClock.nowMs();
+
+    nTick = m_pTickCount->elapsed();
+    if(!m_bTickValid) {
+        // start where the steady clock is so timestamps stay comparable if the interface changes
+        m_llTickBase = m_SteadyClock.nowMs();
+        m_bTickValid = true;
+    }
+    else {
+        // unsigned difference handles the int wrap around
+        m_llTickBase += (unsigned int)nTick - (unsigned int)m_nLastTick;
+    }
+    m_nLastTick = nTick;
+    return m_llTickBase;
+}
+
+void CHostClock::sleepMs(int nMs)
+{
+    SleeperInterface *pSleeper;
+
+    if(nMs <= 0)
+        return;
+
+    {
+        std::lock_guard<std::mutex> lock(m_ClockMutex);
+        pSleeper = m_pSleeper;
+    }
+
+    if(pSleeper)
+        pSleeper->sleep(nMs);
+    else
+        m_SteadyClock.sleepMs(nMs);
+}
+
+
+#pragma mark - Virtual clock
+
+void CVirtualClock::sleepMs(int nMs)
+{
+    if(nMs > 0)
+        m_llNowMs += nMs;
+    // let other threads run, they may be waiting on the same virtual time
+    std::this_thread::yield();
+}
@@ -0,0 +1,80 @@
+//
+//  IndigoClock.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Time source used by the driver for every wait and timestamp.
+//  It can be backed by the host SleeperInterface/TickCountInterface, by std::chrono
+//  or by a virtual clock that only advances when someone sleeps (fast-forward runs).
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoClock_h
+#define IndigoClock_h
+
+// C++ includes
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+#include "../../licensedinterfaces/sleeperinterface.h"
+#include "../../licensedinterfaces/tickcountinterface.h"
+
+class CIndigoClock
+{
+public:
+    virtual ~CIndigoClock() {};
+
+    // monotonic time in ms, the origin is arbitrary
+    virtual long long   nowMs() = 0;
+    virtual void        sleepMs(int nMs) = 0;
+};
+
+// std::chrono steady clock, used when nothing else is provided
+class CSteadyClock : public CIndigoClock
+{
+public:
+    virtual long long   nowMs();
+    virtual void        sleepMs(int nMs);
+};
+
+// host provided sleeper and tick count, falls back to std::chrono for whichever is missing
+class CHostClock : public CIndigoClock
+{
+public:
+    CHostClock(SleeperInterface *pSleeper = NULL, TickCountInterface *pTickCount = NULL);
+
+    void                setInterfaces(SleeperInterface *pSleeper, TickCountInterface *pTickCount);
+
+    virtual long long   nowMs();
+    virtual void        sleepMs(int nMs);
+
+protected:
+    std::mutex          m_ClockMutex;
+    SleeperInterface    *m_pSleeper;
+    TickCountInterface  *m_pTickCount;
+    CSteadyClock        m_SteadyClock;
+
+    // TickCountInterface::elapsed() is an int and wraps, we extend it to 64 bits
+    bool                m_bTickValid;
+    int                 m_nLastTick;
+    long long           m_llTickBase;
+};
+
+// virtual time, sleeping advances the clock instead of blocking
+class CVirtualClock : public CIndigoClock
+{
+public:
+    CVirtualClock(long long llStartMs = 0) { m_llNowMs = llStartMs; };
+
+    virtual long long   nowMs() { return m_llNowMs.load(); };
+    virtual void        sleepMs(int nMs);
+
+    void                advanceMs(long long llMs) { m_llNowMs += llMs; };
+
+protected:
+    std::atomic<long long>  m_llNowMs;
+};
+
+#endif /* IndigoClock_h */
@@ -0,0 +1,39 @@
+//
+//  IndigoFilterInfoInterface.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Optional interface, obtained through queryAbstraction(IndigoFilterInfoInterface_Name, ...).
+//  Per filter metadata from the ini file, so a sequencer can apply the focus offset of the new
+//  filter instead of running an autofocus after each filter change.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoFilterInfoInterface_h
+#define IndigoFilterInfoInterface_h
+
+#define IndigoFilterInfoInterface_Name  "com.rti-zone.PegasusIndigo.IndigoFilterInfoInterface"
+
+#define FILTER_NAME_SIZE    32
+
+typedef struct {
+    char    szName[FILTER_NAME_SIZE];
+    int     nFocusOffset;       // focuser steps, relative to the filter used as focus reference
+    int     nSettleMs;          // preferred wait after the wheel stops, before exposing
+} IndigoFilterInfo;
+
+class IndigoFilterInfoInterface
+{
+public:
+    virtual ~IndigoFilterInfoInterface() {}
+
+    /*!Metadata for a filter. Index is 0 based, as in FilterWheelMoveToInterface.*/
+    virtual int     getFilterInfo(const int &nIndex, IndigoFilterInfo &Info) = 0;
+    /*!Focuser steps to apply when going from one filter to the other.*/
+    virtual int     getFocusOffsetChange(const int &nFromIndex, const int &nToIndex, int &nSteps) = 0;
+    /*!Order with the least wheel travel to take the nCount filters of pnIndexes (repeats allowed),
+    starting from the current filter. pnOrder receives nCount indexes, nTotalMs the estimated travel time.*/
+    virtual int     getFilterOrder(const int *pnIndexes, const int &nCount, int *pnOrder, int &nTotalMs) = 0;
+};
+
+#endif /* IndigoFilterInfoInterface_h */
@@ -0,0 +1,112 @@
+//
+//  IndigoFilterOrder.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoFilterOrder.h"
+
+CIndigoFilterOrder::CIndigoFilterOrder(int nSlots)
+{
+    m_nSlots = std::min(std::max(nSlots, 1), FILTER_TABLE_MAX_SLOTS);
+    for(int i = 1; i <= FILTER_TABLE_MAX_SLOTS; i++) {
+        for(int j = 1; j <= FILTER_TABLE_MAX_SLOTS; j++)
+            m_nCostMs[i - 1][j - 1] = modelCost(i, j, m_nSlots);
+    }
+}
+
+void CIndigoFilterOrder::setCost(int nFromSlot, int nToSlot, int nCostMs)
+{
+    if(!validSlot(nFromSlot) || !validSlot(nToSlot) || nFromSlot == nToSlot)
+        return;
+    m_nCostMs[nFromSlot - 1][nToSlot - 1] = std::max(nCostMs, 0);
+}
+
+int CIndigoFilterOrder::getCost(int nFromSlot, int nToSlot)
+{
+    if(!validSlot(nFromSlot) || !validSlot(nToSlot))
+        return 0;
+    return m_nCostMs[nFromSlot - 1][nToSlot - 1];
+}
+
+int CIndigoFilterOrder::optimize(int nCurrentSlot, const std::vector<int> &vSlots, std::vector<int> &vOrder)
+{
+    std::vector<int> vDistinct;
+    int nCount[FILTER_TABLE_MAX_SLOTS] = {0};
+    int nStates;
+    int nMask, nLast, nNext, nNextMask, nCost;
+    int nBest, nBestLast;
+
+    vOrder.clear();
+    for(int nSlot : vSlots) {
+        if(!validSlot(nSlot))
+            return -1;
+        if(!nCount[nSlot - 1]++)
+            vDistinct.push_back(nSlot);
+    }
+    if(vDistinct.empty())
+        return 0;
+
+    // dp[mask * k + last] : cheapest way from the current slot through the slots of mask, ending on last
+    const int k = int(vDistinct.size());
+    nStates = 1 << k;
+    std::vector<int> vDp(nStates * k, -1);
+    std::vector<signed char> vPrev(nStates * k, -1);
+
+    for(nLast = 0; nLast < k; nLast++)
+        vDp[(1 << nLast) * k + nLast] = validSlot(nCurrentSlot) ? getCost(nCurrentSlot, vDistinct[nLast]) : 0;
+
+    for(nMask = 1; nMask < nStates; nMask++) {
+        for(nLast = 0; nLast < k; nLast++) {
+            nCost = vDp[nMask * k + nLast];
+            if(nCost < 0)
+                continue;
+            for(nNext = 0; nNext < k; nNext++) {
+                if(nMask & (1 << nNext))
+                    continue;
+                nNextMask = nMask | (1 << nNext);
+                int &nNextCost = vDp[nNextMask * k + nNext];
+                if(nNextCost < 0 || nCost + getCost(vDistinct[nLast], vDistinct[nNext]) < nNextCost) {
+                    nNextCost = nCost + getCost(vDistinct[nLast], vDistinct[nNext]);
+                    vPrev[nNextMask * k + nNext] = (signed char)nLast;
+                }
+            }
+        }
+    }
+
+    nMask = nStates - 1;
+    nBest = -1;
+    nBestLast = 0;
+    for(nLast = 0; nLast < k; nLast++) {
+        nCost = vDp[nMask * k + nLast];
+        if(nBest < 0 || nCost < nBest) {
+            nBest = nCost;
+            nBestLast = nLast;
+        }
+    }
+
+    // walk back from the last slot, then expand the repeats
+    std::vector<int> vPath;
+    for(nLast = nBestLast; nLast >= 0; ) {
+        vPath.push_back(vDistinct[nLast]);
+        nNext = vPrev[nMask * k + nLast];
+        nMask &= ~(1 << nLast);
+        nLast = nNext;
+    }
+    for(std::vector<int>::reverse_iterator it = vPath.rbegin(); it != vPath.rend(); ++it)
+        vOrder.insert(vOrder.end(), nCount[*it - 1], *it);
+
+    return nBest;
+}
+
+int CIndigoFilterOrder::modelCost(int nFromSlot, int nToSlot, int nSlots)
+{
+    int nSteps;
+
+    if(nFromSlot == nToSlot || nSlots < 1)
+        return 0;
+    nSteps = ((nToSlot - nFromSlot) % nSlots + nSlots) % nSlots;
+    nSteps = std::min(nSteps, nSlots - nSteps);
+    return FILTER_ORDER_MOVE_OVERHEAD + nSteps * FILTER_ORDER_SLOT_TRAVEL;
+}
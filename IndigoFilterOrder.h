@@ -0,0 +1,48 @@
+//
+//  IndigoFilterOrder.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Cheapest order to visit a set of filters when the plan doesn't care about the order (LRGB blocks, ...).
+//  Exact search (Held-Karp) over the distinct slots, a wheel has at most FILTER_TABLE_MAX_SLOTS so it's
+//  at most 2^10 * 10 states. Repeats of a filter are taken back to back, that move is free.
+//  The cost matrix is filled by the caller, modelCost() is the fallback for transitions never measured.
+//  Settle time is left out, every requested filter pays it once whatever the order.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoFilterOrder_h
+#define IndigoFilterOrder_h
+
+// C++ includes
+#include <vector>
+#include <algorithm>
+
+#include "IndigoFilterTable.h"
+
+#define FILTER_ORDER_MOVE_OVERHEAD  400     // ms, acceleration/deceleration and detent engagement
+#define FILTER_ORDER_SLOT_TRAVEL    350     // ms per slot travelled, the wheel takes the shortest way round
+
+class CIndigoFilterOrder
+{
+public:
+    CIndigoFilterOrder(int nSlots = FILTER_TABLE_MAX_SLOTS);
+
+    int             getSlotCount() { return m_nSlots; };
+    void            setCost(int nFromSlot, int nToSlot, int nCostMs);
+    int             getCost(int nFromSlot, int nToSlot);
+
+    // nCurrentSlot < 1 when unknown, the first move is then free.
+    // Returns the total cost in ms, -1 if a slot is out of range.
+    int             optimize(int nCurrentSlot, const std::vector<int> &vSlots, std::vector<int> &vOrder);
+
+    static int      modelCost(int nFromSlot, int nToSlot, int nSlots);
+
+protected:
+    int             m_nSlots;
+    int             m_nCostMs[FILTER_TABLE_MAX_SLOTS][FILTER_TABLE_MAX_SLOTS];
+
+    bool            validSlot(int nSlot) { return nSlot >= 1 && nSlot <= m_nSlots; };
+};
+
+#endif /* IndigoFilterOrder_h */
@@ -0,0 +1,71 @@
+//
+//  IndigoFilterTable.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoFilterTable.h"
+
+// usual LRGB + narrowband order of the 7 slots wheel
+static const char *DefaultFilterNames[] = {"L", "R", "G", "B", "Ha", "O-III", "S-II"};
+
+CIndigoFilterTable::CIndigoFilterTable()
+{
+    m_bFrozen = false;
+    for(int i = 0; i < FILTER_TABLE_MAX_SLOTS; i++)
+        defaultFilter(i + 1, m_Filters[i]);
+}
+
+bool CIndigoFilterTable::setFilter(int nSlot, const IndigoFilterInfo &Info)
+{
+    if(isFrozen() || nSlot < 1 || nSlot > FILTER_TABLE_MAX_SLOTS)
+        return false;
+
+    m_Filters[nSlot - 1] = Info;
+    m_Filters[nSlot - 1].szName[FILTER_NAME_SIZE - 1] = 0;
+    if(m_Filters[nSlot - 1].nSettleMs < 0)
+        m_Filters[nSlot - 1].nSettleMs = 0;
+    return true;
+}
+
+bool CIndigoFilterTable::getFilter(int nSlot, IndigoFilterInfo &Info) const
+{
+    if(nSlot < 1 || nSlot > FILTER_TABLE_MAX_SLOTS)
+        return false;
+    Info = m_Filters[nSlot - 1];
+    return true;
+}
+
+const char *CIndigoFilterTable::getName(int nSlot) const
+{
+    if(nSlot < 1 || nSlot > FILTER_TABLE_MAX_SLOTS)
+        return "Unknown";
+    return m_Filters[nSlot - 1].szName;
+}
+
+int CIndigoFilterTable::getFocusOffset(int nSlot) const
+{
+    if(nSlot < 1 || nSlot > FILTER_TABLE_MAX_SLOTS)
+        return 0;
+    return m_Filters[nSlot - 1].nFocusOffset;
+}
+
+int CIndigoFilterTable::getSettleMs(int nSlot) const
+{
+    if(nSlot < 1 || nSlot > FILTER_TABLE_MAX_SLOTS)
+        return 0;
+    return m_Filters[nSlot - 1].nSettleMs;
+}
+
+void CIndigoFilterTable::defaultFilter(int nSlot, IndigoFilterInfo &Info)
+{
+    int nNames = int(sizeof(DefaultFilterNames) / sizeof(DefaultFilterNames[0]));
+
+    if(nSlot >= 1 && nSlot <= nNames)
+        snprintf(Info.szName, FILTER_NAME_SIZE, "%s", DefaultFilterNames[nSlot - 1]);
+    else
+        snprintf(Info.szName, FILTER_NAME_SIZE, "Filter %d", nSlot);
+    Info.nFocusOffset = 0;
+    Info.nSettleMs = 0;
+}
@@ -0,0 +1,47 @@
+//
+//  IndigoFilterTable.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Per slot filter metadata (name, focus offset, settle time).
+//  The table is filled once when the driver is created and is read only after freeze(),
+//  so readers don't take any lock. Slots are 1 based, as on the device.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoFilterTable_h
+#define IndigoFilterTable_h
+
+#include <string.h>
+#include <stdio.h>
+
+// C++ includes
+#include <atomic>
+
+#include "IndigoFilterInfoInterface.h"
+
+#define FILTER_TABLE_MAX_SLOTS  10
+
+class CIndigoFilterTable
+{
+public:
+    CIndigoFilterTable();
+
+    // only before freeze()
+    bool            setFilter(int nSlot, const IndigoFilterInfo &Info);
+    void            freeze() { m_bFrozen.store(true, std::memory_order_release); };
+    bool            isFrozen() { return m_bFrozen.load(std::memory_order_acquire); };
+
+    bool            getFilter(int nSlot, IndigoFilterInfo &Info) const;
+    const char      *getName(int nSlot) const;
+    int             getFocusOffset(int nSlot) const;
+    int             getSettleMs(int nSlot) const;
+
+    static void     defaultFilter(int nSlot, IndigoFilterInfo &Info);
+
+protected:
+    IndigoFilterInfo    m_Filters[FILTER_TABLE_MAX_SLOTS];
+    std::atomic<bool>   m_bFrozen;
+};
+
+#endif /* IndigoFilterTable_h */
@@ -0,0 +1,115 @@
+//
+//  IndigoGroup.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoGroup.h"
+
+CIndigoGroup &CIndigoGroup::instance()
+{
+    static CIndigoGroup Group;
+    return Group;
+}
+
+void CIndigoGroup::registerWheel(int nWheel, CPegasusIndigo *pWheel)
+{
+    std::unique_lock<std::mutex> lock(m_GroupMutex);
+
+    // don't pull a wheel out from under a group move
+    m_IdleCond.wait(lock, [&] { return !m_mWheels.count(nWheel) || !m_mWheels[nWheel].nBusy; });
+    m_mWheels[nWheel].pWheel = pWheel;
+    m_mWheels[nWheel].nBusy = 0;
+}
+
+void CIndigoGroup::unregisterWheel(int nWheel, CPegasusIndigo *pWheel)
+{
+    std::unique_lock<std::mutex> lock(m_GroupMutex);
+
+    m_IdleCond.wait(lock, [&] { return !m_mWheels.count(nWheel) || !m_mWheels[nWheel].nBusy; });
+    if(m_mWheels.count(nWheel) && m_mWheels[nWheel].pWheel == pWheel)
+        m_mWheels.erase(nWheel);
+}
+
+int CIndigoGroup::move(const std::vector<IndigoGroupMove> &vMoves, int nTimeoutMs, std::vector<IndigoGroupResult> &vResults, int &nOverallMs)
+{
+    int nErr = PLUGIN_OK;
+    std::vector<CPegasusIndigo *> vWheels(vMoves.size(), NULL);
+    std::vector<long long> vStartMs(vMoves.size(), 0);
+    std::vector<std::thread> vThreads;
+    CIndigoTraceSpan Span("group move", TRACE_CAT_MOVE);
+
+    nOverallMs = 0;
+    vResults.assign(vMoves.size(), IndigoGroupResult());
+    for(size_t i = 0; i < vMoves.size(); i++) {
+        vResults[i].nWheel = vMoves[i].nWheel;
+        vResults[i].nError = ERR_COMMNOLINK;
+        vResults[i].nCommandMs = -1;
+        vResults[i].nCompleteMs = -1;
+    }
+
+    // pin the wheels, a wheel can only be once in a group
+    {
+        std::lock_guard<std::mutex> lock(m_GroupMutex);
+        for(size_t i = 0; i < vMoves.size(); i++) {
+            std::map<int, GroupWheel>::iterator it = m_mWheels.find(vMoves[i].nWheel);
+            if(it == m_mWheels.end() || !it->second.pWheel->IsConnected())
+                continue;
+            if(std::find(vWheels.begin(), vWheels.end(), it->second.pWheel) != vWheels.end()) {
+                vResults[i].nError = PLUGIN_COMMAND_FAILED;
+                continue;
+            }
+            vWheels[i] = it->second.pWheel;
+            it->second.nBusy++;
+        }
+    }
+
+    // the group starts once for everyone, before any thread gets scheduled.
+    // Each wheel has its own clock (they may not share one), the start is read on each of them.
+    for(size_t i = 0; i < vMoves.size(); i++) {
+        if(vWheels[i])
+            vStartMs[i] = vWheels[i]->getClock()->nowMs();
+    }
+    for(size_t i = 0; i < vMoves.size(); i++) {
+        if(vWheels[i])
+            vThreads.push_back(std::thread(&CIndigoGroup::moveWheel, this, vWheels[i], vMoves[i].nSlot, nTimeoutMs, vStartMs[i], std::ref(vResults[i])));
+    }
+    for(std::thread &Thread : vThreads)
+        Thread.join();
+    for(size_t i = 0; i < vMoves.size(); i++) {
+        if(vWheels[i])
+            nOverallMs = std::max(nOverallMs, int(vWheels[i]->getClock()->nowMs() - vStartMs[i]));
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(m_GroupMutex);
+        for(size_t i = 0; i < vMoves.size(); i++) {
+            if(vWheels[i])
+                m_mWheels[vMoves[i].nWheel].nBusy--;
+        }
+    }
+    m_IdleCond.notify_all();
+
+    for(const IndigoGroupResult &Result : vResults) {
+        if(Result.nError && !nErr)
+            nErr = Result.nError;
+    }
+    return nErr;
+}
+
+// llGroupStartMs is on the wheel's clock
+void CIndigoGroup::moveWheel(CPegasusIndigo *pWheel, int nSlot, int nTimeoutMs, long long llGroupStartMs, IndigoGroupResult &Result)
+{
+    CIndigoClock *pClock = pWheel->getClock();
+    CIndigoTraceSpan Span("group wheel", TRACE_CAT_MOVE);
+
+    Result.nError = pWheel->moveToFilterIndex(nSlot);
+    Result.nCommandMs = int(pClock->nowMs() - llGroupStartMs);
+    if(Result.nError)
+        return;
+
+    Result.nError = pWheel->waitForMoveComplete(llGroupStartMs + nTimeoutMs);
+    if(!Result.nError)
+        Result.nCompleteMs = int(pClock->nowMs() - llGroupStartMs);
+}
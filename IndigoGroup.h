@@ -0,0 +1,59 @@
+//
+//  IndigoGroup.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Process wide registry of the linked wheels, and moves of several of them at once.
+//  Each wheel of a group move gets its own thread for the WM and the wait, and every driver
+//  polls through its own move monitor, so no wheel's I/O queues behind another's.
+//  Unregistering a wheel waits for the group moves using it to finish.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoGroup_h
+#define IndigoGroup_h
+
+// C++ includes
+#include <map>
+#include <vector>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "PegasusIndigo.h"
+#include "IndigoGroupInterface.h"
+
+#define GROUP_MOVE_TIMEOUT  30000   // ms
+
+typedef struct {
+    int     nWheel;
+    int     nSlot;              // device slot (1 based)
+} IndigoGroupMove;
+
+class CIndigoGroup
+{
+public:
+    static CIndigoGroup &instance();
+
+    // a later registration of the same index replaces the earlier one
+    void            registerWheel(int nWheel, CPegasusIndigo *pWheel);
+    void            unregisterWheel(int nWheel, CPegasusIndigo *pWheel);
+
+    int             move(const std::vector<IndigoGroupMove> &vMoves, int nTimeoutMs, std::vector<IndigoGroupResult> &vResults, int &nOverallMs);
+
+protected:
+    CIndigoGroup() {};
+
+    typedef struct {
+        CPegasusIndigo  *pWheel;
+        int             nBusy;          // group moves using it
+    } GroupWheel;
+
+    std::mutex              m_GroupMutex;
+    std::condition_variable m_IdleCond;
+    std::map<int, GroupWheel> m_mWheels;
+
+    void            moveWheel(CPegasusIndigo *pWheel, int nSlot, int nTimeoutMs, long long llGroupStartMs, IndigoGroupResult &Result);
+};
+
+#endif /* IndigoGroup_h */
@@ -0,0 +1,36 @@
+//
+//  IndigoGroupInterface.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Optional interface, obtained through queryAbstraction(IndigoGroupInterface_Name, ...) on any instance.
+//  Moves several wheels of the process together (multi scope rigs) and returns once they have all settled.
+//  Wheels are named by the instance index the host gave sbPlugInFactory2, only linked wheels can take part.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoGroupInterface_h
+#define IndigoGroupInterface_h
+
+#define IndigoGroupInterface_Name  "com.rti-zone.PegasusIndigo.IndigoGroupInterface"
+
+#define GROUP_MAX_WHEELS    16
+
+typedef struct {
+    int     nWheel;             // instance index
+    int     nError;             // 0 if the wheel settled on its filter in time
+    int     nCommandMs;         // WM exchange, from the group start
+    int     nCompleteMs;        // from the group start to the wheel settled, -1 if it didn't
+} IndigoGroupResult;
+
+class IndigoGroupInterface
+{
+public:
+    virtual ~IndigoGroupInterface() {}
+
+    /*!Moves wheel pnWheels[i] to filter pnIndexes[i] (0 based) for the nCount wheels, all at once.
+    pResults receives one entry per wheel, nOverallMs the time from the group start until the last one settled or gave up.*/
+    virtual int     groupMove(const int *pnWheels, const int *pnIndexes, const int &nCount, const int &nTimeoutMs, IndigoGroupResult *pResults, int &nOverallMs) = 0;
+};
+
+#endif /* IndigoGroupInterface_h */
@@ -0,0 +1,178 @@
+//
+//  IndigoMoveStats.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoMoveStats.h"
+
+CIndigoMoveStats::CIndigoMoveStats()
+{
+    m_dDriftThreshold = MOVE_STATS_DRIFT_THRESHOLD;
+    clear();
+}
+
+void CIndigoMoveStats::clear()
+{
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    memset(m_Records, 0, sizeof(m_Records));
+    m_bDirty = false;
+}
+
+void CIndigoMoveStats::resetBaseline()
+{
+    int i, j;
+
+    // after maintenance, the next moves become the new reference
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    for(i = 0; i < MOVE_STATS_MAX_SLOTS; i++) {
+        for(j = 0; j < MOVE_STATS_MAX_SLOTS; j++) {
+            m_Records[i][j].nBaselineCount = 0;
+            m_Records[i][j].fBaselineMs = 0;
+            m_Records[i][j].nCount = 0;
+            m_Records[i][j].nHead = 0;
+        }
+    }
+    m_bDirty = true;
+}
+
+void CIndigoMoveStats::setDriftThreshold(double dPercent)
+{
+    if(dPercent > 0)
+        m_dDriftThreshold = dPercent;
+}
+
+void CIndigoMoveStats::recordMove(int nFromSlot, int nToSlot, int nDurationMs)
+{
+    MoveTimeRecord *pRecord;
+
+    if(nFromSlot == nToSlot || nDurationMs <= 0)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    pRecord = getRecord(nFromSlot, nToSlot);
+    if(!pRecord)
+        return;
+
+    if(nDurationMs > 0xFFFF)
+        nDurationMs = 0xFFFF;
+
+    pRecord->nHistory[pRecord->nHead] = (unsigned short)nDurationMs;
+    pRecord->nHead = (pRecord->nHead + 1) % MOVE_STATS_HISTORY;
+    if(pRecord->nCount < MOVE_STATS_HISTORY)
+        pRecord->nCount++;
+
+    if(pRecord->nBaselineCount < MOVE_STATS_BASELINE) {
+        // running mean of the first moves
+        pRecord->fBaselineMs += (nDurationMs - pRecord->fBaselineMs) / (pRecord->nBaselineCount + 1);
+        pRecord->nBaselineCount++;
+    }
+    pRecord->nSamples++;
+    m_bDirty = true;
+}
+
+bool CIndigoMoveStats::getStats(int nFromSlot, int nToSlot, MoveTimeStats &Stats)
+{
+    MoveTimeRecord *pRecord;
+
+    memset(&Stats, 0, sizeof(Stats));
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    pRecord = getRecord(nFromSlot, nToSlot);
+    if(!pRecord || !pRecord->nCount)
+        return false;
+
+    computeStats(*pRecord, Stats);
+    return true;
+}
+
+void CIndigoMoveStats::getFlaggedTransitions(std::vector<std::pair<int,int>> &vTransitions)
+{
+    int i, j;
+    MoveTimeStats Stats;
+
+    vTransitions.clear();
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    for(i = 0; i < MOVE_STATS_MAX_SLOTS; i++) {
+        for(j = 0; j < MOVE_STATS_MAX_SLOTS; j++) {
+            if(!m_Records[i][j].nCount)
+                continue;
+            computeStats(m_Records[i][j], Stats);
+            if(Stats.bFlagged)
+                vTransitions.push_back(std::make_pair(i+1, j+1));
+        }
+    }
+}
+
+std::string CIndigoMoveStats::serialize(int nFromSlot, int nToSlot)
+{
+    MoveTimeRecord *pRecord;
+    std::stringstream ssTmp;
+    int i;
+
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    pRecord = getRecord(nFromSlot, nToSlot);
+    if(!pRecord || !pRecord->nSamples)
+        return "";
+
+    // samples,baseline count,baseline,oldest ... newest
+    ssTmp << pRecord->nSamples << "," << pRecord->nBaselineCount << "," << int(pRecord->fBaselineMs + 0.5);
+    for(i = 0; i < pRecord->nCount; i++)
+        ssTmp << "," << pRecord->nHistory[(pRecord->nHead + MOVE_STATS_HISTORY - pRecord->nCount + i) % MOVE_STATS_HISTORY];
+    return ssTmp.str();
+}
+
+void CIndigoMoveStats::deserialize(int nFromSlot, int nToSlot, const std::string &sRecord)
+{
+    MoveTimeRecord *pRecord;
+    std::stringstream ssTmp(sRecord);
+    std::string sField;
+    std::vector<long> vValues;
+
+    while(std::getline(ssTmp, sField, ','))
+        vValues.push_back(atol(sField.c_str()));
+    if(vValues.size() < 3)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_StatsMutex);
+    pRecord = getRecord(nFromSlot, nToSlot);
+    if(!pRecord)
+        return;
+
+    memset(pRecord, 0, sizeof(MoveTimeRecord));
+    pRecord->nSamples = (unsigned int)vValues[0];
+    pRecord->nBaselineCount = (unsigned short)std::min<long>(vValues[1], MOVE_STATS_BASELINE);
+    pRecord->fBaselineMs = float(vValues[2]);
+    for(size_t i = 3; i < vValues.size(); i++) {
+        pRecord->nHistory[pRecord->nHead] = (unsigned short)vValues[i];
+        pRecord->nHead = (pRecord->nHead + 1) % MOVE_STATS_HISTORY;
+        if(pRecord->nCount < MOVE_STATS_HISTORY)
+            pRecord->nCount++;
+    }
+}
+
+CIndigoMoveStats::MoveTimeRecord *CIndigoMoveStats::getRecord(int nFromSlot, int nToSlot)
+{
+    if(nFromSlot < 1 || nFromSlot > MOVE_STATS_MAX_SLOTS || nToSlot < 1 || nToSlot > MOVE_STATS_MAX_SLOTS)
+        return NULL;
+    return &m_Records[nFromSlot-1][nToSlot-1];
+}
+
+void CIndigoMoveStats::computeStats(const MoveTimeRecord &Record, MoveTimeStats &Stats)
+{
+    int i;
+    double dSum = 0;
+
+    for(i = 0; i < Record.nCount; i++)
+        dSum += Record.nHistory[i];
+
+    Stats.nSamples = int(Record.nSamples);
+    Stats.dBaselineMs = Record.fBaselineMs;
+    Stats.dRecentMs = Record.nCount ? dSum / Record.nCount : 0;
+    Stats.dLastMs = Record.nCount ? Record.nHistory[(Record.nHead + MOVE_STATS_HISTORY - 1) % MOVE_STATS_HISTORY] : 0;
+    Stats.dDriftPercent = Stats.dBaselineMs > 0 ? (Stats.dRecentMs - Stats.dBaselineMs) / Stats.dBaselineMs * 100.0 : 0;
+    // only flag once the baseline is established and there are enough recent moves to compare
+    Stats.bFlagged = Record.nBaselineCount >= MOVE_STATS_BASELINE &&
+                     Record.nCount >= MOVE_STATS_MIN_RECENT &&
+                     Stats.dDriftPercent > m_dDriftThreshold;
+}
@@ -0,0 +1,80 @@
+//
+//  IndigoMoveStats.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Rolling record of move durations per slot transition (from -> to, so direction is part of the key).
+//  Used to detect slow moves caused by mechanical wear (belt, dirty detent, ...) before they time out.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoMoveStats_h
+#define IndigoMoveStats_h
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+// C++ includes
+#include <string>
+#include <sstream>
+#include <vector>
+#include <mutex>
+#include <utility>
+#include <algorithm>
+
+#define MOVE_STATS_MAX_SLOTS        10
+#define MOVE_STATS_HISTORY          16      // most recent moves kept per transition
+#define MOVE_STATS_BASELINE         16      // first moves averaged into the reference time
+#define MOVE_STATS_MIN_RECENT       4       // recent moves needed before a transition can be flagged
+#define MOVE_STATS_DRIFT_THRESHOLD  15.0    // % slower than the baseline before a transition is flagged
+
+typedef struct {
+    int     nSamples;           // total number of moves recorded
+    double  dBaselineMs;        // mean of the first MOVE_STATS_BASELINE moves
+    double  dRecentMs;          // mean of the last MOVE_STATS_HISTORY moves
+    double  dLastMs;
+    double  dDriftPercent;      // (recent - baseline) / baseline
+    bool    bFlagged;
+} MoveTimeStats;
+
+class CIndigoMoveStats
+{
+public:
+    CIndigoMoveStats();
+
+    void            clear();
+    void            resetBaseline();
+    void            setDriftThreshold(double dPercent);
+    double          getDriftThreshold() { return m_dDriftThreshold; };
+
+    void            recordMove(int nFromSlot, int nToSlot, int nDurationMs);
+    bool            getStats(int nFromSlot, int nToSlot, MoveTimeStats &Stats);
+    void            getFlaggedTransitions(std::vector<std::pair<int,int>> &vTransitions);
+
+    // persistence, one compact string per transition
+    bool            isDirty() { return m_bDirty; };
+    void            clearDirty() { m_bDirty = false; };
+    std::string     serialize(int nFromSlot, int nToSlot);
+    void            deserialize(int nFromSlot, int nToSlot, const std::string &sRecord);
+
+protected:
+    typedef struct {
+        unsigned short  nHistory[MOVE_STATS_HISTORY];   // ms, ring buffer
+        unsigned char   nHead;
+        unsigned char   nCount;
+        unsigned short  nBaselineCount;
+        float           fBaselineMs;
+        unsigned int    nSamples;
+    } MoveTimeRecord;
+
+    std::mutex          m_StatsMutex;
+    MoveTimeRecord      m_Records[MOVE_STATS_MAX_SLOTS][MOVE_STATS_MAX_SLOTS];
+    double              m_dDriftThreshold;
+    bool                m_bDirty;
+
+    MoveTimeRecord      *getRecord(int nFromSlot, int nToSlot);
+    void                computeStats(const MoveTimeRecord &Record, MoveTimeStats &Stats);
+};
+
+#endif /* IndigoMoveStats_h */
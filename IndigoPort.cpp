@@ -0,0 +1,662 @@
+//
+//  IndigoPort.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoPort.h"
+
+#pragma mark - SerX port
+
+CIndigoSerXPort::CIndigoSerXPort()
+{
+    m_pSerx = NULL;
+}
+
+int CIndigoSerXPort::open(const char *szPort)
+{
+    if(!m_pSerx)
+        return ERR_COMMNOLINK;
+
+    // 9600 8N1
+    return m_pSerx->open(szPort, 9600, SerXInterface::B_NOPARITY, "-DTR_CONTROL 1");
+}
+
+int CIndigoSerXPort::close()
+{
+    if(!m_pSerx)
+        return ERR_COMMNOLINK;
+    return m_pSerx->close();
+}
+
+bool CIndigoSerXPort::isOpen()
+{
+    if(!m_pSerx)
+        return false;
+    return m_pSerx->isConnected();
+}
+
+int CIndigoSerXPort::purgeTxRx()
+{
+    return m_pSerx->purgeTxRx();
+}
+
+int CIndigoSerXPort::flushTx()
+{
+    return m_pSerx->flushTx();
+}
+
+int CIndigoSerXPort::writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten)
+{
+    return m_pSerx->writeFile(pBuffer, ulBytesToWrite, ulBytesWritten);
+}
+
+int CIndigoSerXPort::bytesWaitingRx(int &nBytesWaiting)
+{
+    return m_pSerx->bytesWaitingRx(nBytesWaiting);
+}
+
+int CIndigoSerXPort::readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long ulTimeout)
+{
+    return m_pSerx->readFile(pBuffer, ulBytesToRead, ulBytesRead, ulTimeout);
+}
+
+
+#pragma mark - Simulated port
+
+CIndigoSimPort::CIndigoSimPort()
+{
+    m_pClock = &m_SteadyClock;
+    m_bOpen = false;
+    m_llRxReady = 0;
+    m_nReplyDelay = SIM_REPLY_DELAY;
+    m_llMoveStart = 0;
+    m_nSlot = 1;
+    m_nFromSlot = 1;
+    m_nTargetSlot = 1;
+    m_nMoveDuration = 0;
+}
+
+int CIndigoSimPort::open(const char * /*szPort*/)
+{
+    std::lock_guard<std::mutex> lock(m_PortMutex);
+    m_bOpen = true;
+    m_sTxBuffer.clear();
+    m_sRxBuffer.clear();
+    return 0;
+}
+
+int CIndigoSimPort::close()
+{
+    std::lock_guard<std::mutex> lock(m_PortMutex);
+    m_bOpen = false;
+    m_sTxBuffer.clear();
+    m_sRxBuffer.clear();
+    return 0;
+}
+
+bool CIndigoSimPort::isOpen()
+{
+    return m_bOpen;
+}
+
+int CIndigoSimPort::purgeTxRx()
+{
+    std::lock_guard<std::mutex> lock(m_PortMutex);
+    m_sTxBuffer.clear();
+    m_sRxBuffer.clear();
+    return 0;
+}
+
+int CIndigoSimPort::flushTx()
+{
+    return 0;
+}
+
+int CIndigoSimPort::writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten)
+{
+    size_t nPos;
+    std::string sCmd;
+
+    std::lock_guard<std::mutex> lock(m_PortMutex);
+    ulBytesWritten = 0;
+    if(!m_bOpen)
+        return ERR_COMMNOLINK;
+
+    m_sTxBuffer.append((const char *)pBuffer, ulBytesToWrite);
+    ulBytesWritten = ulBytesToWrite;
+
+    // each complete line is a command, the firmware answers each of them with one line
+    while((nPos = m_sTxBuffer.find('\n')) != std::string::npos) {
+        sCmd = m_sTxBuffer.substr(0, nPos);
+        m_sTxBuffer.erase(0, nPos+1);
+        m_sRxBuffer += processCommand(sCmd) + "\n";
+        m_llRxReady = m_pClock->nowMs() + m_nReplyDelay;
+    }
+    return 0;
+}
+
+int CIndigoSimPort::bytesWaitingRx(int &nBytesWaiting)
+{
+    std::lock_guard<std::mutex> lock(m_PortMutex);
+    nBytesWaiting = 0;
+    if(!m_bOpen)
+        return ERR_COMMNOLINK;
+
+    if(m_pClock->nowMs() >= m_llRxReady)
+        nBytesWaiting = int(m_sRxBuffer.size());
+    return 0;
+}
+
+int CIndigoSimPort::readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long /*ulTimeout*/)
+{
+    std::lock_guard<std::mutex> lock(m_PortMutex);
+    ulBytesRead = 0;
+    if(!m_bOpen)
+        return ERR_COMMNOLINK;
+
+    if(m_pClock->nowMs() < m_llRxReady)
+        return 0;
+
+    ulBytesRead = std::min<unsigned long>(ulBytesToRead, m_sRxBuffer.size());
+    memcpy(pBuffer, m_sRxBuffer.data(), ulBytesRead);
+    m_sRxBuffer.erase(0, ulBytesRead);
+    return 0;
+}
+
+std::string CIndigoSimPort::processCommand(const std::string &sCmd)
+{
+    std::stringstream ssTmp;
+    int nTarget;
+
+    updateMotion();
+
+    if(sCmd == "W#")
+        return "FW_OK";
+
+    if(sCmd == "WV")
+        return std::string("WV:") + SIM_FIRMWARE;
+
+    if(sCmd == "WR") {
+        ssTmp << "WR:" << (m_nMoveDuration ? 1 : 0);
+        return ssTmp.str();
+    }
+
+    if(sCmd == "WF") {
+        ssTmp << "WF:" << m_nSlot;
+        return ssTmp.str();
+    }
+
+    if(sCmd.compare(0, 3, "WM:") == 0) {
+        nTarget = atoi(sCmd.c_str()+3);
+        if(nTarget < 1 || nTarget > SIM_NB_SLOTS)
+            return "ERR";
+        m_nFromSlot = m_nSlot;
+        m_nTargetSlot = nTarget;
+        m_nMoveDuration = travelTime(m_nFromSlot, m_nTargetSlot);
+        m_llMoveStart = m_pClock->nowMs();
+        ssTmp << "WM:" << nTarget;
+        return ssTmp.str();
+    }
+
+    return "ERR";
+}
+
+void CIndigoSimPort::updateMotion()
+{
+    int nElapsed;
+    int nSteps;
+    int nDone;
+    int nDir;
+
+    if(!m_nMoveDuration)
+        return;
+
+    nElapsed = int(m_pClock->nowMs() - m_llMoveStart);
+    if(nElapsed >= m_nMoveDuration) {
+        m_nSlot = m_nTargetSlot;
+        m_nMoveDuration = 0;
+        return;
+    }
+
+    // report the slot currently passing in front of the sensor, the wheel takes the shortest way
+    nSteps = (m_nTargetSlot - m_nFromSlot + SIM_NB_SLOTS) % SIM_NB_SLOTS;
+    nDir = 1;
+    if(nSteps > SIM_NB_SLOTS/2) {
+        nSteps = SIM_NB_SLOTS - nSteps;
+        nDir = -1;
+    }
+    nDone = std::max(0, nElapsed - SIM_MOVE_OVERHEAD/2) / SIM_SLOT_TRAVEL;
+    nDone = std::min(nDone, nSteps-1);
+    m_nSlot = ((m_nFromSlot - 1 + nDir*nDone + SIM_NB_SLOTS) % SIM_NB_SLOTS) + 1;
+}
+
+int CIndigoSimPort::travelTime(int nFromSlot, int nToSlot)
+{
+    int nSteps;
+
+    nSteps = (nToSlot - nFromSlot + SIM_NB_SLOTS) % SIM_NB_SLOTS;
+    nSteps = std::min(nSteps, SIM_NB_SLOTS - nSteps);
+    if(!nSteps)
+        return 0;
+    return SIM_MOVE_OVERHEAD + nSteps * SIM_SLOT_TRAVEL;
+}
+
+
+#ifdef SB_LINUX_BUILD
+#pragma mark - Linux termios port
+
+CIndigoTermiosPort::CIndigoTermiosPort()
+{
+    m_nFd = -1;
+    m_bLowLatency = false;
+}
+
+CIndigoTermiosPort::~CIndigoTermiosPort()
+{
+    close();
+}
+
+int CIndigoTermiosPort::open(const char *szPort)
+{
+    struct termios tty;
+    int nModemBits = TIOCM_DTR;
+
+    if(m_nFd >= 0)
+        close();
+
+    // non blocking open so we don't wait for carrier detect
+    m_nFd = ::open(szPort, O_RDWR | O_NOCTTY | O_NONBLOCK | O_CLOEXEC);
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+
+    if(ioctl(m_nFd, TIOCEXCL) != 0 || tcgetattr(m_nFd, &tty) != 0) {
+        close();
+        return ERR_COMMNOLINK;
+    }
+
+    // 9600 8N1, raw
+    cfmakeraw(&tty);
+    cfsetispeed(&tty, B9600);
+    cfsetospeed(&tty, B9600);
+    tty.c_cflag |= (CLOCAL | CREAD);
+    tty.c_cflag &= ~(CSTOPB | CRTSCTS);
+    // reads are only issued once poll() says there is data, VTIME bounds a read that catches a partial reply
+    tty.c_cc[VMIN] = 0;
+    tty.c_cc[VTIME] = TERMIOS_VTIME;
+    if(tcsetattr(m_nFd, TCSANOW, &tty) != 0) {
+        close();
+        return ERR_COMMNOLINK;
+    }
+
+    // back to blocking mode now that the port is configured, waits are done in poll()
+    fcntl(m_nFd, F_SETFL, fcntl(m_nFd, F_GETFL) & ~O_NONBLOCK);
+
+    // same as the SerX "-DTR_CONTROL 1" session option
+    ioctl(m_nFd, TIOCMBIS, &nModemBits);
+
+    setLowLatency(szPort);
+    tcflush(m_nFd, TCIOFLUSH);
+    return 0;
+}
+
+int CIndigoTermiosPort::close()
+{
+    if(m_nFd >= 0) {
+        ioctl(m_nFd, TIOCNXCL);
+        ::close(m_nFd);
+    }
+    m_nFd = -1;
+    m_bLowLatency = false;
+    return 0;
+}
+
+int CIndigoTermiosPort::purgeTxRx()
+{
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    return tcflush(m_nFd, TCIOFLUSH) == 0 ? 0 : ERR_COMMNOLINK;
+}
+
+int CIndigoTermiosPort::flushTx()
+{
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    return tcdrain(m_nFd) == 0 ? 0 : ERR_COMMNOLINK;
+}
+
+int CIndigoTermiosPort::writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten)
+{
+    ssize_t nWritten;
+
+    ulBytesWritten = 0;
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+
+    while(ulBytesWritten < ulBytesToWrite) {
+        nWritten = ::write(m_nFd, (const char *)pBuffer + ulBytesWritten, ulBytesToWrite - ulBytesWritten);
+        if(nWritten < 0) {
+            if(errno == EINTR)
+                continue;
+            return ERR_COMMNOLINK;
+        }
+        ulBytesWritten += nWritten;
+    }
+    return 0;
+}
+
+int CIndigoTermiosPort::bytesWaitingRx(int &nBytesWaiting)
+{
+    nBytesWaiting = 0;
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    return ioctl(m_nFd, FIONREAD, &nBytesWaiting) == 0 ? 0 : ERR_COMMNOLINK;
+}
+
+int CIndigoTermiosPort::readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long ulTimeout)
+{
+    ssize_t nRead;
+    int nErr;
+
+    ulBytesRead = 0;
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+
+    while(ulBytesRead < ulBytesToRead) {
+        nErr = waitRx(int(ulTimeout));
+        if(nErr)
+            return nErr;
+        nRead = ::read(m_nFd, (char *)pBuffer + ulBytesRead, ulBytesToRead - ulBytesRead);
+        if(nRead < 0) {
+            if(errno == EINTR)
+                continue;
+            return ERR_COMMNOLINK;
+        }
+        if(nRead == 0) // timeout, the caller sees the short read
+            break;
+        ulBytesRead += nRead;
+    }
+    return 0;
+}
+
+int CIndigoTermiosPort::waitRx(int nTimeoutMs)
+{
+    struct pollfd Pfd;
+    int nRet;
+
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+
+    Pfd.fd = m_nFd;
+    Pfd.events = POLLIN;
+    Pfd.revents = 0;
+    do {
+        nRet = poll(&Pfd, 1, nTimeoutMs);
+    } while(nRet < 0 && errno == EINTR);
+
+    if(nRet < 0 || (Pfd.revents & (POLLERR | POLLHUP | POLLNVAL)))
+        return ERR_COMMNOLINK;
+    return 0;
+}
+
+void CIndigoTermiosPort::setLowLatency(const char *szPort)
+{
+    struct serial_struct Serial;
+    char szRealPath[PATH_MAX];
+    std::string sSysfsPath;
+    const char *pszDevName;
+    FILE *pFile;
+
+    // serial core low latency flag, makes the driver push received bytes to the tty layer immediately
+    if(ioctl(m_nFd, TIOCGSERIAL, &Serial) == 0) {
+        Serial.flags |= ASYNC_LOW_LATENCY;
+        if(ioctl(m_nFd, TIOCSSERIAL, &Serial) == 0)
+            m_bLowLatency = true;
+    }
+
+    // FTDI adapters buffer up to 16 ms before sending to the host, bring that down to 1 ms if we're allowed to
+    if(!realpath(szPort, szRealPath))
+        return;
+    pszDevName = strrchr(szRealPath, '/');
+    pszDevName = pszDevName ? pszDevName + 1 : szRealPath;
+    sSysfsPath = std::string(TERMIOS_SYSFS_PATH) + pszDevName + "/latency_timer";
+    pFile = fopen(sSysfsPath.c_str(), "w");
+    if(pFile) {
+        if(fputs("1", pFile) >= 0)
+            m_bLowLatency = true;
+        fclose(pFile);
+    }
+}
+#endif
+
+#pragma mark - broker client port
+#ifdef SB_LINUX_BUILD
+
+CIndigoBrokerPort::CIndigoBrokerPort()
+{
+    m_nFd = -1;
+    m_nSeq = 0;
+    m_nPurgedSeq = 0;
+}
+
+CIndigoBrokerPort::~CIndigoBrokerPort()
+{
+    close();
+}
+
+std::string CIndigoBrokerPort::socketPath(const char *szPort, bool bCreateDir)
+{
+    char szRealPath[PATH_MAX];
+    char szUserDir[PATH_MAX];
+    const char *pszDevName;
+    const char *pszRuntimeDir;
+    std::string sDir;
+    struct stat Stat;
+
+    pszRuntimeDir = getenv("XDG_RUNTIME_DIR");
+    if(pszRuntimeDir && pszRuntimeDir[0] == '/')
+        sDir.assign(pszRuntimeDir);
+    else {
+        snprintf(szUserDir, PATH_MAX, "%s%u", BROKER_SOCKET_DIR, (unsigned int)getuid());
+        sDir.assign(szUserDir);
+    }
+    if(bCreateDir)
+        mkdir(sDir.c_str(), 0700);
+    if(lstat(sDir.c_str(), &Stat) != 0)
+        return std::string();
+    // someone else's directory, or one others can get into, could hold a fake broker
+    if(!S_ISDIR(Stat.st_mode) || Stat.st_uid != getuid() || (Stat.st_mode & 077)) {
+        errno = EACCES;
+        return std::string();
+    }
+
+    // /dev/serial/by-id/... and /dev/ttyUSB0 must end up on the same broker
+    if(!realpath(szPort, szRealPath)) {
+        strncpy(szRealPath, szPort, PATH_MAX - 1);
+        szRealPath[PATH_MAX - 1] = 0;
+    }
+    pszDevName = strrchr(szRealPath, '/');
+    pszDevName = pszDevName ? pszDevName + 1 : szRealPath;
+    return sDir + "/" + BROKER_SOCKET_PREFIX + pszDevName + BROKER_SOCKET_SUFFIX;
+}
+
+int CIndigoBrokerPort::open(const char *szPort)
+{
+    struct sockaddr_un Addr;
+    std::string sPath;
+
+    if(m_nFd >= 0)
+        close();
+
+    sPath = socketPath(szPort);
+    if(sPath.empty() || sPath.size() >= sizeof(Addr.sun_path))
+        return ERR_COMMNOLINK;
+
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    strncpy(Addr.sun_path, sPath.c_str(), sizeof(Addr.sun_path) - 1);
+
+    m_nFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    if(connect(m_nFd, (struct sockaddr *)&Addr, sizeof(Addr)) != 0) {
+        close();
+        return ERR_COMMNOLINK;
+    }
+    m_sFrameBuffer.clear();
+    m_sRxBuffer.clear();
+    m_nPurgedSeq = m_nSeq;
+    return 0;
+}
+
+int CIndigoBrokerPort::close()
+{
+    if(m_nFd >= 0)
+        ::close(m_nFd);
+    m_nFd = -1;
+    m_sFrameBuffer.clear();
+    m_sRxBuffer.clear();
+    return 0;
+}
+
+int CIndigoBrokerPort::purgeTxRx()
+{
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    // late replies to anything already sent are dropped when they arrive
+    m_nPurgedSeq = m_nSeq;
+    m_sRxBuffer.clear();
+    return 0;
+}
+
+int CIndigoBrokerPort::flushTx()
+{
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    return 0;
+}
+
+int CIndigoBrokerPort::writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten)
+{
+    IndigoBrokerFrame Frame;
+    std::string sFrame;
+    size_t nSent = 0;
+    ssize_t nRet;
+
+    ulBytesWritten = 0;
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    if(ulBytesToWrite > BROKER_MAX_PAYLOAD)
+        return ERR_CMDFAILED;
+
+    Frame.nSeq = ++m_nSeq;
+    Frame.nLength = (uint16_t)ulBytesToWrite;
+    // every Pegasus command gets exactly one reply line
+    Frame.nLines = (uint16_t)std::count((const char *)pBuffer, (const char *)pBuffer + ulBytesToWrite, '\n');
+
+    sFrame.assign((const char *)&Frame, sizeof(Frame));
+    sFrame.append((const char *)pBuffer, ulBytesToWrite);
+    while(nSent < sFrame.size()) {
+        nRet = send(m_nFd, sFrame.data() + nSent, sFrame.size() - nSent, MSG_NOSIGNAL);
+        if(nRet < 0) {
+            if(errno == EINTR)
+                continue;
+            close();
+            return ERR_COMMNOLINK;
+        }
+        nSent += nRet;
+    }
+    ulBytesWritten = ulBytesToWrite;
+    return 0;
+}
+
+int CIndigoBrokerPort::bytesWaitingRx(int &nBytesWaiting)
+{
+    int nErr;
+
+    nBytesWaiting = 0;
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    nErr = receiveFrames();
+    nBytesWaiting = int(m_sRxBuffer.size());
+    return nErr;
+}
+
+int CIndigoBrokerPort::readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long ulTimeout)
+{
+    int nErr;
+
+    ulBytesRead = 0;
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+
+    if(m_sRxBuffer.size() < ulBytesToRead) {
+        nErr = waitRx(int(ulTimeout));
+        if(nErr)
+            return nErr;
+    }
+    ulBytesRead = std::min((unsigned long)m_sRxBuffer.size(), ulBytesToRead);
+    memcpy(pBuffer, m_sRxBuffer.data(), ulBytesRead);
+    m_sRxBuffer.erase(0, ulBytesRead);
+    return 0;
+}
+
+int CIndigoBrokerPort::waitRx(int nTimeoutMs)
+{
+    struct pollfd Pfd;
+    int nRet;
+
+    if(m_nFd < 0)
+        return ERR_COMMNOLINK;
+    if(!m_sRxBuffer.empty())
+        return 0;
+
+    Pfd.fd = m_nFd;
+    Pfd.events = POLLIN;
+    Pfd.revents = 0;
+    do {
+        nRet = poll(&Pfd, 1, nTimeoutMs);
+    } while(nRet < 0 && errno == EINTR);
+
+    if(nRet < 0 || (Pfd.revents & (POLLERR | POLLNVAL))) {
+        close();
+        return ERR_COMMNOLINK;
+    }
+    if(nRet == 0)
+        return 0;
+    return receiveFrames();
+}
+
+int CIndigoBrokerPort::receiveFrames()
+{
+    IndigoBrokerFrame Frame;
+    char szBuffer[BROKER_MAX_PAYLOAD];
+    ssize_t nRead;
+
+    while(true) {
+        nRead = recv(m_nFd, szBuffer, sizeof(szBuffer), MSG_DONTWAIT);
+        if(nRead > 0) {
+            m_sFrameBuffer.append(szBuffer, nRead);
+            continue;
+        }
+        if(nRead < 0 && errno == EINTR)
+            continue;
+        if(nRead < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+            break;
+        // broker went away
+        close();
+        return ERR_COMMNOLINK;
+    }
+
+    while(m_sFrameBuffer.size() >= sizeof(Frame)) {
+        memcpy(&Frame, m_sFrameBuffer.data(), sizeof(Frame));
+        if(m_sFrameBuffer.size() < sizeof(Frame) + Frame.nLength)
+            break;
+        if(int32_t(Frame.nSeq - m_nPurgedSeq) > 0)
+            m_sRxBuffer.append(m_sFrameBuffer, sizeof(Frame), Frame.nLength);
+        m_sFrameBuffer.erase(0, sizeof(Frame) + Frame.nLength);
+    }
+    return 0;
+}
+#endif
@@ -0,0 +1,221 @@
+//
+//  IndigoPort.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Transport layer used by CPegasusIndigo.
+//  Everything above this layer (command formatting, response parsing, move logic)
+//  is the same whatever the port is : the host SerX port or the built-in simulator.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoPort_h
+#define IndigoPort_h
+
+#include <string.h>
+#include <stdio.h>
+#ifdef SB_LINUX_BUILD
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
+#include <limits.h>
+#include <poll.h>
+#include <termios.h>
+#include <sys/ioctl.h>
+#include <linux/serial.h>
+#include <stdint.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <sys/stat.h>
+#endif
+
+// C++ includes
+#include <string>
+#include <sstream>
+#include <vector>
+#include <mutex>
+#include <algorithm>
+
+#include "../../licensedinterfaces/sberrorx.h"
+#include "../../licensedinterfaces/serxinterface.h"
+
+#include "IndigoClock.h"
+
+// transport selection, stored in the ini file
+enum IndigoTransports {TRANSPORT_SERX = 0, TRANSPORT_SIMULATOR, TRANSPORT_TERMIOS, TRANSPORT_BROKER};
+
+// simulated wheel model
+#define SIM_NB_SLOTS        7
+#define SIM_FIRMWARE        "1.0-sim"
+#define SIM_MOVE_OVERHEAD   400     // ms, acceleration/deceleration and detent engagement
+#define SIM_SLOT_TRAVEL     350     // ms per slot travelled
+#define SIM_REPLY_DELAY     12      // ms between the end of a command and the reply being available
+
+class CIndigoPort
+{
+public:
+    virtual ~CIndigoPort() {};
+
+    virtual int     open(const char *szPort) = 0;
+    virtual int     close() = 0;
+    virtual bool    isOpen() = 0;
+
+    virtual int     purgeTxRx() = 0;
+    virtual int     flushTx() = 0;
+    virtual int     writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten) = 0;
+    virtual int     bytesWaitingRx(int &nBytesWaiting) = 0;
+    virtual int     readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long ulTimeout) = 0;
+
+    // ports that can block until data arrives, instead of being polled
+    virtual bool    canWaitRx() { return false; };
+    virtual int     waitRx(int /*nTimeoutMs*/) { return 0; };
+};
+
+// host provided serial port
+class CIndigoSerXPort : public CIndigoPort
+{
+public:
+    CIndigoSerXPort();
+
+    void            setSerx(SerXInterface *p) { m_pSerx = p; };
+
+    virtual int     open(const char *szPort);
+    virtual int     close();
+    virtual bool    isOpen();
+
+    virtual int     purgeTxRx();
+    virtual int     flushTx();
+    virtual int     writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten);
+    virtual int     bytesWaitingRx(int &nBytesWaiting);
+    virtual int     readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long ulTimeout);
+
+protected:
+    SerXInterface   *m_pSerx;
+};
+
+// simulated wheel, answers the Indigo protocol without any hardware
+class CIndigoSimPort : public CIndigoPort
+{
+public:
+    CIndigoSimPort();
+
+    void            setClock(CIndigoClock *pClock) { m_pClock = pClock; };
+    void            setReplyDelay(int nDelayMs) { m_nReplyDelay = nDelayMs; };
+
+    virtual int     open(const char *szPort);
+    virtual int     close();
+    virtual bool    isOpen();
+
+    virtual int     purgeTxRx();
+    virtual int     flushTx();
+    virtual int     writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten);
+    virtual int     bytesWaitingRx(int &nBytesWaiting);
+    virtual int     readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long ulTimeout);
+
+protected:
+    std::mutex      m_PortMutex;
+    CIndigoClock    *m_pClock;
+    CSteadyClock    m_SteadyClock;
+    bool            m_bOpen;
+
+    std::string     m_sTxBuffer;
+    std::string     m_sRxBuffer;
+    long long       m_llRxReady;
+    int             m_nReplyDelay;
+
+    int             m_nSlot;
+    int             m_nFromSlot;
+    int             m_nTargetSlot;
+    int             m_nMoveDuration;
+    long long       m_llMoveStart;
+
+    std::string     processCommand(const std::string &sCmd);
+    void            updateMotion();
+    int             travelTime(int nFromSlot, int nToSlot);
+};
+
+#ifdef SB_LINUX_BUILD
+// native Linux tty, bypasses the host SerX polling model
+#define TERMIOS_VTIME       1       // 1/10 s, inter byte timeout once a read has started
+#define TERMIOS_SYSFS_PATH  "/sys/bus/usb-serial/devices/"
+
+class CIndigoTermiosPort : public CIndigoPort
+{
+public:
+    CIndigoTermiosPort();
+    virtual ~CIndigoTermiosPort();
+
+    virtual int     open(const char *szPort);
+    virtual int     close();
+    virtual bool    isOpen() { return m_nFd >= 0; };
+
+    virtual int     purgeTxRx();
+    virtual int     flushTx();
+    virtual int     writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten);
+    virtual int     bytesWaitingRx(int &nBytesWaiting);
+    virtual int     readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long ulTimeout);
+
+    virtual bool    canWaitRx() { return true; };
+    virtual int     waitRx(int nTimeoutMs);
+
+    bool            isLowLatency() { return m_bLowLatency; };
+
+protected:
+    int             m_nFd;
+    bool            m_bLowLatency;
+
+    void            setLowLatency(const char *szPort);
+};
+
+// client side of the serial broker (broker/indigo_broker), which owns the tty and
+// serialises requests from several drivers. One writeFile is one request frame, the broker
+// writes it to the tty and sends back as many reply lines as there were command lines.
+// The socket sits in a directory only the user can enter, $XDG_RUNTIME_DIR or a 0700 directory
+// in /tmp, so no other user can put a fake broker in its place. Driver and broker run as the same user.
+#define BROKER_SOCKET_DIR       "/tmp/pegasus_broker-"  // followed by the uid when there is no XDG_RUNTIME_DIR
+#define BROKER_SOCKET_PREFIX    "pegasus_broker_"
+#define BROKER_SOCKET_SUFFIX    ".sock"
+#define BROKER_MAX_PAYLOAD      1024
+#define BROKER_REPLY_TIMEOUT    1000    // ms the broker waits for the reply lines of a request
+
+typedef struct {
+    uint32_t    nSeq;       // set by the client, echoed in the reply
+    uint16_t    nLines;     // request : reply lines expected, reply : reply lines received
+    uint16_t    nLength;    // payload bytes following the header
+} IndigoBrokerFrame;
+
+class CIndigoBrokerPort : public CIndigoPort
+{
+public:
+    CIndigoBrokerPort();
+    virtual ~CIndigoBrokerPort();
+
+    // socket the broker serving that tty listens on, same on both sides whatever alias is used for the tty.
+    // Empty if the directory isn't private to us, bCreateDir makes it if it doesn't exist (broker side)
+    static std::string socketPath(const char *szPort, bool bCreateDir = false);
+
+    virtual int     open(const char *szPort);
+    virtual int     close();
+    virtual bool    isOpen() { return m_nFd >= 0; };
+
+    virtual int     purgeTxRx();
+    virtual int     flushTx();
+    virtual int     writeFile(void *pBuffer, unsigned long ulBytesToWrite, unsigned long &ulBytesWritten);
+    virtual int     bytesWaitingRx(int &nBytesWaiting);
+    virtual int     readFile(void *pBuffer, unsigned long ulBytesToRead, unsigned long &ulBytesRead, unsigned long ulTimeout);
+
+    virtual bool    canWaitRx() { return true; };
+    virtual int     waitRx(int nTimeoutMs);
+
+protected:
+    int             m_nFd;
+    uint32_t        m_nSeq;
+    uint32_t        m_nPurgedSeq;       // replies to requests up to this one are dropped
+    std::string     m_sFrameBuffer;     // raw bytes from the socket, may end with a partial frame
+    std::string     m_sRxBuffer;        // reply payloads, what the driver reads
+
+    int             receiveFrames();
+};
+#endif
+
+#endif /* IndigoPort_h */
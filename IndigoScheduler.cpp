@@ -0,0 +1,99 @@
+//
+//  IndigoScheduler.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoScheduler.h"
+
+static const char *PriorityNames[PRIORITY_COUNT] = {"motion", "motion_status", "info"};
+
+CIndigoScheduler::CIndigoScheduler()
+{
+    m_pClock = &m_SteadyClock;
+    m_nDepth = 0;
+    m_llHoldStartUs = -1;
+    m_nHoldPriority = PRIORITY_INFO;
+    for(int i = 0; i < PRIORITY_COUNT; i++) {
+        m_nWaiting[i] = 0;
+        m_llMaxWaitMs[i] = 0;
+    }
+}
+
+void CIndigoScheduler::acquire(int nPriority)
+{
+    long long llStart;
+    long long llWait;
+    long long llTraceStartUs = -1;
+
+    if(nPriority < 0 || nPriority >= PRIORITY_COUNT)
+        nPriority = PRIORITY_INFO;
+
+    std::unique_lock<std::mutex> lock(m_SchedulerMutex);
+    if(m_nDepth && m_Owner == std::this_thread::get_id()) {
+        m_nDepth++;
+        return;
+    }
+
+    if(CIndigoTrace::instance().isEnabled())
+        llTraceStartUs = CIndigoTrace::nowUs();
+    llStart = m_pClock->nowMs();
+    m_nWaiting[nPriority]++;
+    m_SchedulerCond.wait(lock, [&] { return m_nDepth == 0 && !higherPriorityWaiting(nPriority); });
+    m_nWaiting[nPriority]--;
+
+    m_Owner = std::this_thread::get_id();
+    m_nDepth = 1;
+
+    llWait = m_pClock->nowMs() - llStart;
+    if(llWait > m_llMaxWaitMs[nPriority])
+        m_llMaxWaitMs[nPriority] = llWait;
+
+    m_llHoldStartUs = -1;
+    if(llTraceStartUs >= 0) {
+        m_llHoldStartUs = CIndigoTrace::nowUs();
+        m_nHoldPriority = nPriority;
+        CIndigoTrace::instance().complete("port wait", TRACE_CAT_LOCK, llTraceStartUs, m_llHoldStartUs - llTraceStartUs, "priority", PriorityNames[nPriority]);
+    }
+}
+
+void CIndigoScheduler::release()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+        if(!m_nDepth || m_Owner != std::this_thread::get_id())
+            return;
+        m_nDepth--;
+        if(m_nDepth)
+            return;
+        m_Owner = std::thread::id();
+        if(m_llHoldStartUs >= 0)
+            CIndigoTrace::instance().complete("port held", TRACE_CAT_LOCK, m_llHoldStartUs, CIndigoTrace::nowUs() - m_llHoldStartUs, "priority", PriorityNames[m_nHoldPriority]);
+    }
+    m_SchedulerCond.notify_all();
+}
+
+long long CIndigoScheduler::getMaxWaitMs(int nPriority)
+{
+    if(nPriority < 0 || nPriority >= PRIORITY_COUNT)
+        return 0;
+    std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+    return m_llMaxWaitMs[nPriority];
+}
+
+void CIndigoScheduler::resetStats()
+{
+    std::lock_guard<std::mutex> lock(m_SchedulerMutex);
+    for(int i = 0; i < PRIORITY_COUNT; i++)
+        m_llMaxWaitMs[i] = 0;
+}
+
+bool CIndigoScheduler::higherPriorityWaiting(int nPriority)
+{
+    for(int i = 0; i < nPriority; i++) {
+        if(m_nWaiting[i])
+            return true;
+    }
+    return false;
+}
@@ -0,0 +1,66 @@
+//
+//  IndigoScheduler.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Arbitrates access to the port between threads. When the port is released the waiting request
+//  with the highest priority gets it, so a move never queues behind informational queries.
+//  The owner thread can re-enter (Connect runs several commands under one acquisition).
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoScheduler_h
+#define IndigoScheduler_h
+
+// C++ includes
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+
+#include "IndigoClock.h"
+#include "IndigoTrace.h"
+
+// lower value = higher priority
+enum IndigoCommandPriorities {PRIORITY_MOTION = 0, PRIORITY_MOTION_STATUS, PRIORITY_INFO, PRIORITY_COUNT};
+
+class CIndigoScheduler
+{
+public:
+    CIndigoScheduler();
+
+    void            setClock(CIndigoClock *pClock) { m_pClock = pClock; };
+
+    void            acquire(int nPriority);
+    void            release();
+
+    // longest time a request of that class waited for the port, in ms
+    long long       getMaxWaitMs(int nPriority);
+    void            resetStats();
+
+protected:
+    std::mutex              m_SchedulerMutex;
+    std::condition_variable m_SchedulerCond;
+    CIndigoClock            *m_pClock;
+    CSteadyClock            m_SteadyClock;
+
+    std::thread::id         m_Owner;
+    int                     m_nDepth;
+    int                     m_nWaiting[PRIORITY_COUNT];
+    long long               m_llMaxWaitMs[PRIORITY_COUNT];
+    long long               m_llHoldStartUs;        // trace only
+    int                     m_nHoldPriority;
+
+    bool                    higherPriorityWaiting(int nPriority);
+};
+
+class CIndigoSchedulerLock
+{
+public:
+    CIndigoSchedulerLock(CIndigoScheduler &Scheduler, int nPriority) : m_Scheduler(Scheduler) { m_Scheduler.acquire(nPriority); };
+    ~CIndigoSchedulerLock() { m_Scheduler.release(); };
+
+private:
+    CIndigoScheduler        &m_Scheduler;
+};
+
+#endif /* IndigoScheduler_h */
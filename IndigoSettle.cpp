@@ -0,0 +1,43 @@
+//
+//  IndigoSettle.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoSettle.h"
+
+CIndigoSettleModel::CIndigoSettleModel()
+{
+    clear();
+}
+
+void CIndigoSettleModel::clear()
+{
+    for(int i = 0; i < FILTER_TABLE_MAX_SLOTS; i++)
+        m_nWindowMs[i] = SETTLE_DEFAULT_WINDOW;
+}
+
+int CIndigoSettleModel::getWindowMs(int nSlot)
+{
+    if(nSlot < 1 || nSlot > FILTER_TABLE_MAX_SLOTS)
+        return SETTLE_DEFAULT_WINDOW;
+    return m_nWindowMs[nSlot - 1];
+}
+
+void CIndigoSettleModel::noteRelapse(int nSlot, int nStableRunMs)
+{
+    if(nSlot < 1 || nSlot > FILTER_TABLE_MAX_SLOTS)
+        return;
+    int &nWindow = m_nWindowMs[nSlot - 1];
+    // 50% over the run that fooled us, plus one poll since we only see the relapse on the next sample
+    nWindow = std::min(std::max(nWindow, nStableRunMs * 3 / 2 + SETTLE_POLL_INTERVAL), SETTLE_MAX_WINDOW);
+}
+
+void CIndigoSettleModel::noteSettled(int nSlot, bool bRelapsed)
+{
+    if(nSlot < 1 || nSlot > FILTER_TABLE_MAX_SLOTS || bRelapsed)
+        return;
+    int &nWindow = m_nWindowMs[nSlot - 1];
+    nWindow = std::max(SETTLE_MIN_WINDOW, nWindow - (nWindow - SETTLE_MIN_WINDOW) / SETTLE_DECAY);
+}
@@ -0,0 +1,43 @@
+//
+//  IndigoSettle.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Per slot settle window : how long the wheel must be seen stopped on the same slot before we call it settled.
+//  When a slot relapses (moves again after looking stable) the window grows past the stable run we were
+//  fooled by; clean settles slowly shrink it back toward the minimum.
+//  Not locked, the driver only calls it with m_StatusMutex held.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoSettle_h
+#define IndigoSettle_h
+
+// C++ includes
+#include <algorithm>
+
+#include "IndigoFilterTable.h"
+
+#define SETTLE_POLL_INTERVAL    50      // ms between two polls while confirming the position
+#define SETTLE_MIN_WINDOW       100     // ms
+#define SETTLE_DEFAULT_WINDOW   150     // ms, before anything was learned for the slot
+#define SETTLE_MAX_WINDOW       2000    // ms
+#define SETTLE_DECAY            8       // a clean settle removes 1/8 of the window above the minimum
+
+class CIndigoSettleModel
+{
+public:
+    CIndigoSettleModel();
+
+    void            clear();
+    int             getWindowMs(int nSlot);
+
+    // nStableRunMs : how long the slot looked settled before moving again
+    void            noteRelapse(int nSlot, int nStableRunMs);
+    void            noteSettled(int nSlot, bool bRelapsed);
+
+protected:
+    int             m_nWindowMs[FILTER_TABLE_MAX_SLOTS];
+};
+
+#endif /* IndigoSettle_h */
@@ -0,0 +1,40 @@
+//
+//  IndigoStatusInterface.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Optional interface, obtained through queryAbstraction(IndigoStatusInterface_Name, ...).
+//  Gives the full wheel status in one call, from a single pipelined exchange or from cache.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoStatusInterface_h
+#define IndigoStatusInterface_h
+
+#define IndigoStatusInterface_Name  "com.rti-zone.PegasusIndigo.IndigoStatusInterface"
+
+#define STATUS_FIRMWARE_SIZE    64
+#define STATUS_CACHE_MAX_AGE    250     // ms
+
+typedef struct {
+    bool    bConnected;
+    int     nCurrentSlot;       // -1 if unknown
+    int     nTargetSlot;
+    bool    bMoving;
+    char    szFirmware[STATUS_FIRMWARE_SIZE];
+    int     nLastError;         // last communication error, 0 if none
+    int     nAgeMs;             // age of the slot and motion data, -1 if never read
+    int     nSettledAgeMs;      // time since the wheel settled after the last move, -1 while moving or settling
+} IndigoStatusSnapshot;
+
+class IndigoStatusInterface
+{
+public:
+    virtual ~IndigoStatusInterface() {}
+
+    /*!Fill Snapshot with the wheel status. Data older than nMaxAgeMs is refreshed from the device first.
+    Slot numbers are 0 based, as in FilterWheelMoveToInterface.*/
+    virtual int     getStatusSnapshot(IndigoStatusSnapshot &Snapshot, const int &nMaxAgeMs) = 0;
+};
+
+#endif /* IndigoStatusInterface_h */
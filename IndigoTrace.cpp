@@ -0,0 +1,264 @@
+//
+//  IndigoTrace.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoTrace.h"
+
+CIndigoTrace &CIndigoTrace::instance()
+{
+    static CIndigoTrace Trace;
+    return Trace;
+}
+
+CIndigoTrace::CIndigoTrace()
+{
+    m_bEnabled = false;
+    m_pEvents = NULL;
+    m_nWriteIndex = 0;
+    m_nReadIndex = 0;
+    m_nDropped = 0;
+    m_nDroppedWritten = 0;
+    m_llOriginUs = 0;
+    m_nUsers = 0;
+    m_bFlushStop = false;
+    m_pFile = NULL;
+    m_bFirstEvent = true;
+}
+
+CIndigoTrace::~CIndigoTrace()
+{
+    // every start was matched by a stop unless an instance leaked, then this is our last chance
+    close();
+    delete [] m_pEvents;
+}
+
+int CIndigoTrace::start(const char *szPath)
+{
+    std::lock_guard<std::mutex> StartLock(m_StartMutex);
+
+    if(!szPath || !szPath[0])
+        return -1;
+    if(m_bEnabled) {
+        m_nUsers++;
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(m_FlushMutex);
+    m_pFile = fopen(szPath, "w");
+    if(!m_pFile)
+        return -1;
+    // the array is only closed by stop(), the viewers accept an open one so a crash doesn't lose the file
+    fputs("[\n", m_pFile);
+    m_bFirstEvent = true;
+
+    // kept after stop(), a late writer may still be filling a slot
+    if(!m_pEvents)
+        m_pEvents = new IndigoTraceEvent[TRACE_BUFFER_EVENTS];
+    for(int i = 0; i < TRACE_BUFFER_EVENTS; i++)
+        m_pEvents[i].nSeq = 0;
+    m_nWriteIndex = 0;
+    m_nReadIndex = 0;
+    m_nDropped = 0;
+    m_nDroppedWritten = 0;
+    m_llOriginUs = nowUs();
+
+    m_bFlushStop = false;
+    m_FlushThread = std::thread(&CIndigoTrace::flushLoop, this);
+    m_bEnabled.store(true, std::memory_order_release);
+    m_nUsers = 1;
+    return 0;
+}
+
+void CIndigoTrace::stop()
+{
+    std::lock_guard<std::mutex> StartLock(m_StartMutex);
+
+    if(!m_nUsers || --m_nUsers)
+        return;
+    close();
+}
+
+// m_StartMutex held, or from the destructor
+void CIndigoTrace::close()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_FlushMutex);
+        if(!m_bEnabled)
+            return;
+        m_bEnabled = false;
+        m_bFlushStop = true;
+    }
+    m_FlushCond.notify_all();
+    if(m_FlushThread.joinable())
+        m_FlushThread.join();
+
+    drain();
+    fputs("\n]\n", m_pFile);
+    fclose(m_pFile);
+    m_pFile = NULL;
+}
+
+long long CIndigoTrace::nowUs()
+{
+    return std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void CIndigoTrace::complete(const char *pszName, const char *pszCat, long long llStartUs, long long llDurUs, const char *pszArgName, const char *pszArg)
+{
+    record('X', pszName, pszCat, llStartUs, llDurUs, 0, pszArgName, pszArg);
+}
+
+void CIndigoTrace::asyncBegin(const char *pszName, const char *pszCat, unsigned long long nId, const char *pszArgName, const char *pszArg)
+{
+    record('b', pszName, pszCat, nowUs(), 0, nId, pszArgName, pszArg);
+}
+
+void CIndigoTrace::asyncEnd(const char *pszName, const char *pszCat, unsigned long long nId)
+{
+    record('e', pszName, pszCat, nowUs(), 0, nId, NULL, NULL);
+}
+
+void CIndigoTrace::threadName(const char *pszName)
+{
+    record('M', "thread_name", "", nowUs(), 0, 0, "name", pszName);
+}
+
+void CIndigoTrace::record(char cPhase, const char *pszName, const char *pszCat, long long llTsUs, long long llDurUs, unsigned long long nId, const char *pszArgName, const char *pszArg)
+{
+    uint64_t nIndex;
+    uint64_t nPending;
+
+    if(!m_bEnabled.load(std::memory_order_acquire))
+        return;
+
+    // claim a slot, or drop the event if the flush thread is a whole ring behind
+    nIndex = m_nWriteIndex.load(std::memory_order_relaxed);
+    do {
+        if(nIndex - m_nReadIndex.load(std::memory_order_acquire) >= TRACE_BUFFER_EVENTS) {
+            m_nDropped++;
+            return;
+        }
+    } while(!m_nWriteIndex.compare_exchange_weak(nIndex, nIndex + 1, std::memory_order_acq_rel));
+
+    IndigoTraceEvent &Event = m_pEvents[nIndex % TRACE_BUFFER_EVENTS];
+    Event.cPhase = cPhase;
+    Event.pszName = pszName;
+    Event.pszCat = pszCat;
+    Event.llTsUs = llTsUs - m_llOriginUs;
+    Event.llDurUs = llDurUs;
+    Event.nId = nId;
+    Event.nTid = threadId();
+    Event.pszArgName = pszArg ? pszArgName : NULL;
+    if(pszArg)
+        snprintf(Event.szArg, TRACE_ARG_SIZE, "%s", pszArg);
+    Event.nSeq.store(nIndex + 1, std::memory_order_release);
+
+    nPending = nIndex + 1 - m_nReadIndex.load(std::memory_order_relaxed);
+    if(nPending == TRACE_BUFFER_EVENTS / 2)
+        m_FlushCond.notify_one();
+}
+
+void CIndigoTrace::flushLoop()
+{
+    std::unique_lock<std::mutex> lock(m_FlushMutex);
+
+    threadName("trace flush");
+    while(!m_bFlushStop) {
+        m_FlushCond.wait_for(lock, std::chrono::milliseconds(TRACE_FLUSH_INTERVAL));
+        lock.unlock();
+        drain();
+        lock.lock();
+    }
+}
+
+// flush thread only, or after it has been joined
+void CIndigoTrace::drain()
+{
+    uint64_t nIndex = m_nReadIndex.load(std::memory_order_relaxed);
+    uint64_t nDropped;
+
+    if(!m_pFile)
+        return;
+
+    while(true) {
+        IndigoTraceEvent &Event = m_pEvents[nIndex % TRACE_BUFFER_EVENTS];
+        // stop at the first slot still being written, it will be there next time
+        if(Event.nSeq.load(std::memory_order_acquire) != nIndex + 1)
+            break;
+        writeEvent(Event);
+        nIndex++;
+        m_nReadIndex.store(nIndex, std::memory_order_release);
+    }
+
+    // the gaps in the timeline are only explained if the loss is in the file too
+    nDropped = m_nDropped;
+    if(nDropped != m_nDroppedWritten) {
+        fprintf(m_pFile, "%s{\"name\":\"dropped events\",\"ph\":\"C\",\"ts\":%lld,\"pid\":1,\"args\":{\"events\":%llu}}",
+                m_bFirstEvent ? "" : ",\n", nowUs() - m_llOriginUs, (unsigned long long)nDropped);
+        m_bFirstEvent = false;
+        m_nDroppedWritten = nDropped;
+    }
+    fflush(m_pFile);
+}
+
+void CIndigoTrace::writeEvent(const IndigoTraceEvent &Event)
+{
+    char szArgs[64] = "";
+
+    if(Event.pszArgName) {
+        std::string sArg;
+        // arguments are short driver strings, only quotes and backslashes need escaping
+        for(const char *p = Event.szArg; *p; p++) {
+            if(*p == '"' || *p == '\\')
+                sArg += '\\';
+            if((unsigned char)*p >= 0x20)
+                sArg += *p;
+        }
+        snprintf(szArgs, sizeof(szArgs), ",\"args\":{\"%s\":\"%s\"}", Event.pszArgName, sArg.c_str());
+    }
+
+    fprintf(m_pFile, "%s{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"%c\",\"ts\":%lld", m_bFirstEvent ? "" : ",\n", Event.pszName, Event.pszCat, Event.cPhase, Event.llTsUs);
+    if(Event.cPhase == 'X')
+        fprintf(m_pFile, ",\"dur\":%lld", Event.llDurUs);
+    if(Event.cPhase == 'b' || Event.cPhase == 'e')
+        fprintf(m_pFile, ",\"id\":%llu", Event.nId);
+    fprintf(m_pFile, ",\"pid\":1,\"tid\":%d%s}", Event.nTid, szArgs);
+    m_bFirstEvent = false;
+}
+
+int CIndigoTrace::threadId()
+{
+    static std::atomic<int> nNextId(1);
+    thread_local int nId = 0;
+
+    if(!nId)
+        nId = nNextId++;
+    return nId;
+}
+
+#pragma mark - span
+
+CIndigoTraceSpan::CIndigoTraceSpan(const char *pszName, const char *pszCat, const char *pszArgName, const char *pszArg)
+{
+    m_llStartUs = -1;
+    if(!CIndigoTrace::instance().isEnabled())
+        return;
+
+    m_pszName = pszName;
+    m_pszCat = pszCat;
+    m_pszArgName = pszArg ? pszArgName : NULL;
+    if(pszArg)
+        snprintf(m_szArg, TRACE_ARG_SIZE, "%s", pszArg);
+    m_llStartUs = CIndigoTrace::nowUs();
+}
+
+void CIndigoTraceSpan::end()
+{
+    if(m_llStartUs < 0)
+        return;
+    CIndigoTrace::instance().complete(m_pszName, m_pszCat, m_llStartUs, CIndigoTrace::nowUs() - m_llStartUs, m_pszArgName, m_pszArgName ? m_szArg : NULL);
+    m_llStartUs = -1;
+}
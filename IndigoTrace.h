@@ -0,0 +1,121 @@
+//
+//  IndigoTrace.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Optional timeline of the driver activity in the Chrome / Perfetto trace event format
+//  (load the file in ui.perfetto.dev or chrome://tracing).
+//  Events go to a ring buffer allocated once when tracing starts; a background thread writes
+//  them out, so recording never touches the disk. When the ring is full new events are dropped
+//  and counted, the count is written to the trace as the "dropped events" counter.
+//  Tracing is process wide, all driver instances share the file. Each start() that succeeded
+//  needs a stop(), the last one closes the file.
+//  Event names, categories and argument names must be string literals, only the pointer is kept.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoTrace_h
+#define IndigoTrace_h
+
+#include <string.h>
+#include <stdio.h>
+#include <stdint.h>
+
+// C++ includes
+#include <string>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <chrono>
+
+#define TRACE_BUFFER_EVENTS     16384
+#define TRACE_FLUSH_INTERVAL    250     // ms
+#define TRACE_ARG_SIZE          16
+
+#define TRACE_CAT_X2    "x2"
+#define TRACE_CAT_LOCK  "lock"
+#define TRACE_CAT_IO    "io"
+#define TRACE_CAT_WAIT  "wait"
+#define TRACE_CAT_MOVE  "move"
+
+typedef struct {
+    std::atomic<uint64_t>   nSeq;       // index + 1 once the event is complete
+    char                    cPhase;     // X complete, b/e async begin/end, M metadata
+    const char              *pszName;
+    const char              *pszCat;
+    long long               llTsUs;
+    long long               llDurUs;
+    unsigned long long      nId;        // async events
+    int                     nTid;
+    const char              *pszArgName;
+    char                    szArg[TRACE_ARG_SIZE];
+} IndigoTraceEvent;
+
+class CIndigoTrace
+{
+public:
+    static CIndigoTrace &instance();
+    ~CIndigoTrace();
+
+    // opens szPath, or joins the trace already running. 0 when the caller holds a reference
+    int             start(const char *szPath);
+    // releases a reference, the last one flushes and closes the file
+    void            stop();
+    bool            isEnabled() { return m_bEnabled.load(std::memory_order_relaxed); };
+    uint64_t        getDropped() { return m_nDropped; };
+
+    static long long nowUs();
+
+    void            complete(const char *pszName, const char *pszCat, long long llStartUs, long long llDurUs, const char *pszArgName = NULL, const char *pszArg = NULL);
+    void            asyncBegin(const char *pszName, const char *pszCat, unsigned long long nId, const char *pszArgName = NULL, const char *pszArg = NULL);
+    void            asyncEnd(const char *pszName, const char *pszCat, unsigned long long nId);
+    // names the calling thread in the viewer
+    void            threadName(const char *pszName);
+
+protected:
+    CIndigoTrace();
+
+    std::atomic<bool>       m_bEnabled;
+    IndigoTraceEvent        *m_pEvents;
+    std::atomic<uint64_t>   m_nWriteIndex;
+    std::atomic<uint64_t>   m_nReadIndex;
+    std::atomic<uint64_t>   m_nDropped;
+    uint64_t                m_nDroppedWritten;  // last count put in the file, flush thread only
+    long long               m_llOriginUs;
+
+    std::mutex              m_StartMutex;       // start / stop, held while the flush thread is joined
+    int                     m_nUsers;
+    std::mutex              m_FlushMutex;
+    std::condition_variable m_FlushCond;
+    std::thread             m_FlushThread;
+    bool                    m_bFlushStop;
+    FILE                    *m_pFile;
+    bool                    m_bFirstEvent;
+
+    void            close();
+    void            record(char cPhase, const char *pszName, const char *pszCat, long long llTsUs, long long llDurUs, unsigned long long nId, const char *pszArgName, const char *pszArg);
+    void            flushLoop();
+    void            drain();
+    void            writeEvent(const IndigoTraceEvent &Event);
+    static int      threadId();
+};
+
+// span from construction to end() or destruction
+class CIndigoTraceSpan
+{
+public:
+    CIndigoTraceSpan(const char *pszName, const char *pszCat, const char *pszArgName = NULL, const char *pszArg = NULL);
+    ~CIndigoTraceSpan() { end(); };
+
+    void            end();
+
+private:
+    const char      *m_pszName;
+    const char      *m_pszCat;
+    const char      *m_pszArgName;
+    char            m_szArg[TRACE_ARG_SIZE];
+    long long       m_llStartUs;    // -1 when tracing was off at construction
+};
+
+#endif /* IndigoTrace_h */
@@ -13,38 +13,77 @@ CPegasusIndigo::CPegasusIndigo()
     m_bIsConnected = false;
     m_nCurentFilterSlot = -1;
     m_nTargetFilterSlot = 0;
-
-#ifdef PLUGIN_DEBUG
-#if defined(SB_WIN_BUILD)
-    m_sLogfilePath = getenv("HOMEDRIVE");
-    m_sLogfilePath += getenv("HOMEPATH");
-    m_sLogfilePath += "\\PegasusIndigoLog.txt";
-#elif defined(SB_LINUX_BUILD)
-    m_sLogfilePath = getenv("HOME");
-    m_sLogfilePath += "/PegasusIndigoLog.txt";
-#elif defined(SB_MAC_BUILD)
-    m_sLogfilePath = getenv("HOME");
-    m_sLogfilePath += "/PegasusIndigoLog.txt";
-#endif
-    m_sLogFile.open(m_sLogfilePath, std::ios::out |std::ios::trunc);
-#endif
-
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [CPegasusIndigo] Version " << std::fixed << std::setprecision(2) << PLUGIN_VERSION << " build " << __DATE__ << " " << __TIME__ << std::endl;
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [CPegasusIndigo] Constructor Called." << std::endl;
-    m_sLogFile.flush();
-#endif
-
+    m_nFilterCount = INDIGO_NB_SLOTS;
+    m_nLastError = PLUGIN_OK;
+    m_bStatusMoving = false;
+    m_nStatusSlot = -1;
+    m_llStatusTimeMs = -1;
+    m_bMoveTimed = false;
+    m_nMoveFromSlot = -1;
+    m_llMoveStartMs = 0;
+    m_nTransport = TRANSPORT_SERX;
+    m_pPort = &m_SerxPort;
+    m_pCustomPort = NULL;
+    m_pClock = &m_SteadyClock;
+    m_Scheduler.setClock(m_pClock);
+    m_llLastExchangeMs = 0;
+    m_bHeartbeatStop = false;
+    m_nHeartbeatInterval = HEARTBEAT_INTERVAL;
+    m_bLinkLost = false;
+    m_HeartbeatThreadId = std::thread::id();
+    m_nHeartbeatFailures = 0;
+    m_nReconnectDelay = HEARTBEAT_RETRY_DELAY;
+    m_bMonitorStop = false;
+    m_MonitorThreadId = std::thread::id();
+    m_nMoveError = PLUGIN_OK;
+    m_pMoveCallback = NULL;
+    m_pMoveCallbackContext = NULL;
+    m_bSettling = false;
+    m_bSettleRelapsed = false;
+    m_nSettleSlot = -1;
+    m_llStableSinceMs = -1;
+    m_llSettledMs = -1;
+    m_nMoveTraceId = 0;
+    m_nLinkGracePeriod = LINK_GRACE_PERIOD;
+    m_bParked = false;
+    m_bGraceStop = false;
+    // nothing else here, the host builds an instance of every installed plugin when it starts.
+    // The log file, threads and the trace are set up by the first Connect / move.
 }
 
 CPegasusIndigo::~CPegasusIndigo()
 {
-
+    stopMoveMonitor();
+    stopHeartbeat();
+    releaseParkedPort();
 }
 
 int CPegasusIndigo::Connect(const char *szPort)
 {
     int nErr = PLUGIN_OK;
+    int nSlot = -1;
+    std::string sFirmware;
+    CIndigoPort *pPort;
+
+#ifdef PLUGIN_DEBUG
+    openLog();
+#endif
+
+    // the background threads must not hold the port while we (re)open it
+    stopMoveMonitor();
+    stopHeartbeat();
+    stopGraceTimer();
+    CIndigoSchedulerLock PortLock(m_Scheduler, PRIORITY_MOTION);
+    {
+        // a move left over from the previous link would make getStatus skip the handshake
+        std::lock_guard<std::mutex> lock(m_StatusMutex);
+        m_bStatusMoving = false;
+        m_bSettling = false;
+        m_nTargetFilterSlot = 0;
+        m_nCurentFilterSlot = -1;
+        m_nStatusSlot = -1;
+        m_llStatusTimeMs = -1;
+    }
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Connect Called." << std::endl;
@@ -52,8 +91,38 @@ int CPegasusIndigo::Connect(const char *szPort)
     m_sLogFile.flush();
 #endif
 
-    // 9600 8N1
-    if(m_pSerx->open(szPort, 9600, SerXInterface::B_NOPARITY, "-DTR_CONTROL 1") == 0)
+    if(m_pCustomPort)
+        pPort = m_pCustomPort;
+    else if(m_nTransport == TRANSPORT_SIMULATOR)
+        pPort = &m_SimPort;
+#ifdef SB_LINUX_BUILD
+    else if(m_nTransport == TRANSPORT_TERMIOS)
+        pPort = &m_TermiosPort;
+    else if(m_nTransport == TRANSPORT_BROKER)
+        pPort = &m_BrokerPort;
+#endif
+    else
+        pPort = &m_SerxPort;
+
+    // same port as the one we kept open, the device and what we know about it haven't changed
+    if(m_bParked && pPort == m_pPort && m_sPortName == szPort && m_pPort->isOpen()) {
+        m_bParked = false;
+        nErr = relink();
+        if(nErr == PLUGIN_OK)
+            return nErr;
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] quick re-link failed : " << nErr << ", full connect" << std::endl;
+        m_sLogFile.flush();
+#endif
+        m_bParked = true;
+    }
+    closeParkedPort();
+    m_pPort = pPort;
+
+    setLastError(PLUGIN_OK);
+    m_sPortName.assign(szPort);
+    m_bLinkLost = false;
+    if(m_pPort->open(szPort) == 0)
         m_bIsConnected = true;
     else
         m_bIsConnected = false;
@@ -75,12 +144,12 @@ int CPegasusIndigo::Connect(const char *szPort)
 #endif
 
         m_bIsConnected = false;
-        m_pSerx->close();
+        m_pPort->close();
         return ERR_DEVICENOTSUPPORTED;
     }
 
     // if any of this fails we're not properly connected or there is a hardware issue.
-    nErr = getFirmwareVersion(m_sFirmwareVersion);
+    nErr = getFirmwareVersion(sFirmware);
     if(nErr) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Error Getting Firmware : " << nErr << std::endl;
@@ -88,7 +157,7 @@ int CPegasusIndigo::Connect(const char *szPort)
 #endif
 
         m_bIsConnected = false;
-        m_pSerx->close();
+        m_pPort->close();
         return FIRMWARE_NOT_SUPPORTED;
     }
 
@@ -97,8 +166,29 @@ int CPegasusIndigo::Connect(const char *szPort)
     m_sLogFile.flush();
 #endif
 
-    nErr = getCurrentSlot(m_nCurentFilterSlot);
-    
+    m_nFilterCount = defaultFilterCount(sFirmware);
+    nErr = getCurrentSlot(nSlot);
+    if(nErr) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Connect] Error Getting current slot : " << nErr << std::endl;
+        m_sLogFile.flush();
+#endif
+
+        m_bIsConnected = false;
+        m_pPort->close();
+        return nErr;
+    }
+
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    m_sFirmwareVersion = sFirmware;
+    m_nCurentFilterSlot = nSlot;
+    m_bSettling = false;
+    m_nStatusSlot = nSlot;
+    m_bStatusMoving = false;
+    m_llStatusTimeMs = m_pClock->nowMs();
+    m_llSettledMs = m_llStatusTimeMs;
+    startHeartbeat();
+
     return nErr;
 }
 
@@ -106,39 +196,106 @@ int CPegasusIndigo::Connect(const char *szPort)
 
 void CPegasusIndigo::Disconnect()
 {
+    bool bParked;
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     m_sLogFile << "["<<getTimeStamp()<<"]"<< " [Disconnect] Called" << std::endl;
     m_sLogFile.flush();
 #endif
 
-    if(m_bIsConnected) {
-        m_pSerx->purgeTxRx();
-        m_pSerx->close();
+    stopMoveMonitor();
+    stopHeartbeat();
+    {
+        CIndigoSchedulerLock PortLock(m_Scheduler, PRIORITY_MOTION);
+        // a lost link is not worth keeping
+        if(m_bIsConnected && m_nLinkGracePeriod && !m_bLinkLost)
+            m_bParked = true;
+        else if(m_bIsConnected) {
+            m_pPort->purgeTxRx();
+            m_pPort->close();
+        }
+        m_bLinkLost = false;
+        m_bIsConnected = false;
+        bParked = m_bParked;
+
+        std::lock_guard<std::mutex> lock(m_StatusMutex);
+        m_bStatusMoving = false;
+        m_bSettling = false;
+        m_llStatusTimeMs = -1;
+        traceMoveEnd();
     }
-    m_bIsConnected = false;
+    if(bParked)
+        startGraceTimer();
+}
+
+
+void CPegasusIndigo::setClock(CIndigoClock *pClock)
+{
+    if(m_bIsConnected)
+        return;
+
+    if(pClock)
+        m_pClock = pClock;
+    else
+        m_pClock = &m_SteadyClock;
+    // the simulated wheel runs on the same time base as the driver
+    m_SimPort.setClock(m_pClock);
+    m_Scheduler.setClock(m_pClock);
+}
+
+void CPegasusIndigo::setTransport(int nTransport)
+{
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [setTransport] Transport : " << nTransport << std::endl;
+    m_sLogFile.flush();
+#endif
+    // the transport is selected when connecting, keep the current one while the port is open
+    if(m_bIsConnected)
+        return;
+
+    if(nTransport == TRANSPORT_SIMULATOR)
+        m_nTransport = TRANSPORT_SIMULATOR;
+#ifdef SB_LINUX_BUILD
+    else if(nTransport == TRANSPORT_TERMIOS)
+        m_nTransport = TRANSPORT_TERMIOS;
+    else if(nTransport == TRANSPORT_BROKER)
+        m_nTransport = TRANSPORT_BROKER;
+#endif
+    else
+        m_nTransport = TRANSPORT_SERX;
 }
 
 
 #pragma mark - communication functions
 
-int CPegasusIndigo::sendCommand(const std::string sCmd, std::string &sResp, int nTimeout)
+int CPegasusIndigo::sendCommand(const std::string sCmd, std::string &sResp, int nTimeout, int nPriority)
 {
     int nErr = PLUGIN_OK;
     unsigned long  ulBytesWrite;
 
-    m_pSerx->purgeTxRx();
     sResp.clear();
+    // don't wait for a full timeout on a link the heartbeat already knows is dead
+    if(linkLostFor(std::this_thread::get_id()))
+        return ERR_COMMNOLINK;
+
+    CIndigoTraceSpan Span("sendCommand", TRACE_CAT_IO, "cmd", sCmd.c_str());
+    CIndigoSchedulerLock PortLock(m_Scheduler, nPriority);
+    m_pPort->purgeTxRx();
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     m_sLogFile << "["<<getTimeStamp()<<"]"<< " [sendCommand] sending "<< sCmd<< std::endl;
     m_sLogFile.flush();
 #endif
 
-    nErr = m_pSerx->writeFile((void *)sCmd.c_str(), sCmd.size(), ulBytesWrite);
-    m_pSerx->flushTx();
-    if(nErr)
+    {
+        CIndigoTraceSpan WriteSpan("writeFile", TRACE_CAT_IO);
+        nErr = m_pPort->writeFile((void *)sCmd.c_str(), sCmd.size(), ulBytesWrite);
+        m_pPort->flushTx();
+    }
+    if(nErr) {
+        setLastError(nErr);
         return nErr;
+    }
 
     // read response
     if(nTimeout == 0) // no response expected
@@ -150,8 +307,10 @@ int CPegasusIndigo::sendCommand(const std::string sCmd, std::string &sResp, int
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [sendCommand] ***** ERROR READING RESPONSE **** error = " << nErr << " , response : " << sResp << std::endl;
         m_sLogFile.flush();
 #endif
+        setLastError(nErr);
         return nErr;
     }
+    m_llLastExchangeMs = m_pClock->nowMs();
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
     m_sLogFile << "["<<getTimeStamp()<<"]"<< " [sendCommand] response " << sResp <<  std::endl;
     m_sLogFile.flush();
@@ -161,42 +320,118 @@ int CPegasusIndigo::sendCommand(const std::string sCmd, std::string &sResp, int
 }
 
 
-int CPegasusIndigo::readResponse(std::string &sResp, int nTimeout)
+int CPegasusIndigo::sendCommands(const std::vector<std::string> &vCmds, std::vector<std::string> &vResps, int nTimeout, int nPriority)
+{
+    int nErr = PLUGIN_OK;
+    unsigned long  ulBytesWrite;
+    std::string sCmds;
+    std::string sResp;
+
+    vResps.clear();
+    // all the commands go out in one write, the firmware answers them in order, one line each
+    for(const std::string &sCmd : vCmds)
+        sCmds += sCmd;
+
+    if(linkLostFor(std::this_thread::get_id()))
+        return ERR_COMMNOLINK;
+
+    CIndigoTraceSpan Span("sendCommands", TRACE_CAT_IO, "cmd", sCmds.c_str());
+    CIndigoSchedulerLock PortLock(m_Scheduler, nPriority);
+    m_pPort->purgeTxRx();
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [sendCommands] sending "<< sCmds << std::endl;
+    m_sLogFile.flush();
+#endif
+
+    {
+        CIndigoTraceSpan WriteSpan("writeFile", TRACE_CAT_IO);
+        nErr = m_pPort->writeFile((void *)sCmds.c_str(), sCmds.size(), ulBytesWrite);
+        m_pPort->flushTx();
+    }
+    if(nErr) {
+        setLastError(nErr);
+        return nErr;
+    }
+
+    nErr = readResponse(sResp, nTimeout, int(vCmds.size()));
+    if(nErr) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [sendCommands] ***** ERROR READING RESPONSE **** error = " << nErr << " , response : " << sResp << std::endl;
+        m_sLogFile.flush();
+#endif
+        setLastError(nErr);
+        return nErr;
+    }
+    m_llLastExchangeMs = m_pClock->nowMs();
+
+    parseFields(sResp, vResps, '\n');
+    for(std::string &sLine : vResps)
+        rtrim(sLine, "\n\r");
+    if(vResps.size() != vCmds.size()) {
+        nErr = PLUGIN_BAD_CMD_RESPONSE;
+        setLastError(nErr);
+    }
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [sendCommands] responses " << vResps.size() << " : " << sResp << std::endl;
+    m_sLogFile.flush();
+#endif
+
+    return nErr;
+}
+
+
+int CPegasusIndigo::readResponse(std::string &sResp, int nTimeout, int nLines)
 {
     int nErr = PLUGIN_OK;
-    char pszBuf[SERIAL_BUFFER_SIZE];
+    char pszBuf[SERIAL_BUFFER_SIZE+1];
     unsigned long ulBytesRead = 0;
     unsigned long ulTotalBytesRead = 0;
+    unsigned long i;
     char *pszBufPtr;
     int nBytesWaiting = 0 ;
-    int nbTimeouts = 0;
+    int nLinesRead = 0;
+    long long llDeadline;
+    CIndigoTraceSpan Span("readResponse", TRACE_CAT_IO);
 
-    memset(pszBuf, 0, SERIAL_BUFFER_SIZE);
+    memset(pszBuf, 0, SERIAL_BUFFER_SIZE+1);
     pszBufPtr = pszBuf;
+    llDeadline = m_pClock->nowMs() + nTimeout;
 
     do {
-        nErr = m_pSerx->bytesWaitingRx(nBytesWaiting);
+        nErr = m_pPort->bytesWaitingRx(nBytesWaiting);
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 3
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] nBytesWaiting      : " << nBytesWaiting << std::endl;
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] nBytesWaiting nErr : " << nErr << std::endl;
         m_sLogFile.flush();
 #endif
         if(!nBytesWaiting) {
-            nbTimeouts += MAX_READ_WAIT_TIMEOUT;
-            if(nbTimeouts >= nTimeout) {
+            if(m_pClock->nowMs() >= llDeadline) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 3
-                m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] bytesWaitingRx timeout, no data for " << nbTimeouts << " ms"<< std::endl;
+                m_sLogFile << "["<<getTimeStamp()<<"]"<< " [readResponse] bytesWaitingRx timeout, no data for " << nTimeout << " ms"<< std::endl;
                 m_sLogFile.flush();
 #endif
                 nErr = PLUGIN_COMMAND_TIMEOUT;
                 break;
             }
-            std::this_thread::sleep_for(std::chrono::milliseconds(MAX_READ_WAIT_TIMEOUT));
+            // block until data arrives when the port can, otherwise poll
+            if(m_pPort->canWaitRx()) {
+                CIndigoTraceSpan WaitSpan("waitRx", TRACE_CAT_WAIT);
+                nErr = m_pPort->waitRx(int(std::min<long long>(llDeadline - m_pClock->nowMs(), MAX_READ_WAIT_TIMEOUT)));
+                if(nErr)
+                    break;
+            }
+            else {
+                CIndigoTraceSpan SleepSpan("sleep", TRACE_CAT_WAIT);
+                m_pClock->sleepMs(MAX_READ_WAIT_TIMEOUT);
+            }
             continue;
         }
-        nbTimeouts = 0;
-        if(ulTotalBytesRead + nBytesWaiting <= SERIAL_BUFFER_SIZE)
-            nErr = m_pSerx->readFile(pszBufPtr, nBytesWaiting, ulBytesRead, nTimeout);
+        llDeadline = m_pClock->nowMs() + nTimeout;
+        if(ulTotalBytesRead + nBytesWaiting <= SERIAL_BUFFER_SIZE) {
+            CIndigoTraceSpan ReadSpan("readFile", TRACE_CAT_IO);
+            nErr = m_pPort->readFile(pszBufPtr, nBytesWaiting, ulBytesRead, nTimeout);
+        }
         else {
             nErr = ERR_RXTIMEOUT;
             break; // buffer is full.. there is a problem !!
@@ -218,9 +453,13 @@ int CPegasusIndigo::readResponse(std::string &sResp, int nTimeout)
 #endif
         }
 
+        for(i = 0; i < ulBytesRead; i++) {
+            if(pszBufPtr[i] == '\n')
+                nLinesRead++;
+        }
         ulTotalBytesRead += ulBytesRead;
         pszBufPtr+=ulBytesRead;
-    }  while (ulTotalBytesRead < SERIAL_BUFFER_SIZE  && *(pszBufPtr-1) != '\n');
+    }  while (ulTotalBytesRead < SERIAL_BUFFER_SIZE  && nLinesRead < nLines);
 
     if(!ulTotalBytesRead)
         nErr = PLUGIN_COMMAND_TIMEOUT; // we didn't get an answer.. so timeout
@@ -245,8 +484,12 @@ int CPegasusIndigo::getStatus()
     if(!m_bIsConnected)
         return ERR_COMMNOLINK;
 
+    // the motion status polling already proves the link, don't get in the way of a move
+    if(isMoveInProgress())
+        return PLUGIN_OK;
+
     // OK_UPB or OK_PPB
-    nErr = sendCommand("W#\n", sResp);
+    nErr = sendCommand("W#\n", sResp, MAX_TIMEOUT, PRIORITY_INFO);
     if(nErr)
         return nErr;
     if(sResp.find("FW_OK") ==-1) {
@@ -270,7 +513,16 @@ int CPegasusIndigo::getFirmwareVersion(std::string &sVersion)
     if(!m_bIsConnected)
         return PLUGIN_NOT_CONNECTED;
 
-    nErr = sendCommand("WV\n", sResp);
+    // served from cache while the wheel is moving
+    if(isMoveInProgress()) {
+        std::lock_guard<std::mutex> lock(m_StatusMutex);
+        if(!m_sFirmwareVersion.empty()) {
+            sVersion = m_sFirmwareVersion;
+            return nErr;
+        }
+    }
+
+    nErr = sendCommand("WV\n", sResp, MAX_TIMEOUT, PRIORITY_INFO);
     if(nErr) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getFirmwareVersion] Error Getting response from sendCommand : " << nErr << std::endl;
@@ -296,13 +548,18 @@ int CPegasusIndigo::getFirmwareVersion(std::string &sVersion)
     return nErr;
 }
 
+std::string CPegasusIndigo::getCachedFirmwareVersion()
+{
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    return m_sFirmwareVersion;
+}
+
 
 #pragma mark - Filter Wheel move commands
 
 int CPegasusIndigo::moveToFilterIndex(int nTargetPosition)
 {
     int nErr = 0;
-    std::stringstream ssTmp;
     std::string sResp;
 
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
@@ -311,90 +568,321 @@ int CPegasusIndigo::moveToFilterIndex(int nTargetPosition)
     m_sLogFile.flush();
 #endif
 
-    ssTmp << "WM:" << nTargetPosition << "\n";
-    nErr = sendCommand(ssTmp.str(), sResp);
-    if(nErr) {
+    {
+        CIndigoSchedulerLock PortLock(m_Scheduler, PRIORITY_MOTION);
+        // Disconnect may have closed or parked the port since the caller checked
+        if(!m_bIsConnected)
+            return ERR_COMMNOLINK;
+
+        m_llMoveStartMs = m_pClock->nowMs();
+        nErr = sendCommand(moveCommand(nTargetPosition), sResp, MAX_TIMEOUT, PRIORITY_MOTION);
+        if(nErr) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [moveToFilterIndex] Error Getting response from sendCommand : " << nErr << std::endl;
-        m_sLogFile.flush();
+            m_sLogFile << "["<<getTimeStamp()<<"]"<< " [moveToFilterIndex] Error Getting response from sendCommand : " << nErr << std::endl;
+            m_sLogFile.flush();
 #endif
-        return nErr;
+            return nErr;
+        }
+
+        std::lock_guard<std::mutex> lock(m_StatusMutex);
+        m_nTargetFilterSlot = nTargetPosition;
+        m_nMoveFromSlot = m_nCurentFilterSlot;
+        // the cached status is from before the move
+        m_bStatusMoving = (m_nCurentFilterSlot != m_nTargetFilterSlot);
+        m_llStatusTimeMs = -1;
+        m_bMoveTimed = (m_nMoveFromSlot > 0 && m_nMoveFromSlot != m_nTargetFilterSlot);
+        m_nMoveError = PLUGIN_OK;
+        // settling starts on the first poll that sees the wheel stopped or on target
+        m_bSettling = false;
+        m_llSettledMs = m_bStatusMoving ? -1 : m_pClock->nowMs();
+        traceMoveBegin(nTargetPosition);
+        m_MonitorCond.notify_all();
     }
-    m_nTargetFilterSlot = nTargetPosition;
+    // not under the port lock, stopMoveMonitor holds the monitor mutex while the monitor needs the port
+    startMoveMonitor();
 
     return nErr;
 }
 
+std::string CPegasusIndigo::moveCommand(int nTargetPosition)
+{
+    std::stringstream ssTmp;
+
+    ssTmp << "WM:" << nTargetPosition << "\n";
+    return ssTmp.str();
+}
+
 int CPegasusIndigo::isMoveToComplete(bool &bComplete)
 {
     int nErr = PLUGIN_OK;
-    std::string sResp;
-    std::vector<std::string> vFieldsData;
-    int nFilterSlot;
-
-    bComplete = false;
 
-    if(m_nCurentFilterSlot == m_nTargetFilterSlot) {
-        bComplete = true;
-        return nErr;
-    }
+    // the move monitor keeps the status fresh, nothing goes to the wheel from here
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    bComplete = !moveInProgressLocked();
+    if(!bComplete)
+        nErr = m_nMoveError;
 
-    
-    nErr = sendCommand("WR\n", sResp);
-    if(nErr) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isMoveToComplete] Error Getting response from sendCommand : " << nErr << std::endl;
-        m_sLogFile.flush();
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isMoveToComplete] bComplete : " << (bComplete?"Yes":"No") << std::endl;
+    m_sLogFile.flush();
 #endif
-        return nErr;
+
+    return nErr;
+}
+
+int CPegasusIndigo::waitForMoveComplete(long long llDeadlineMs)
+{
+    long long llNow;
+
+    std::unique_lock<std::mutex> lock(m_StatusMutex);
+    while(moveInProgressLocked()) {
+        if(!m_bIsConnected)
+            return ERR_COMMNOLINK;
+        if(m_nMoveError)
+            return m_nMoveError;
+        llNow = m_pClock->nowMs();
+        if(llNow >= llDeadlineMs)
+            return PLUGIN_COMMAND_TIMEOUT;
+        // woken after every poll, the bound also covers a virtual clock that only moves when someone sleeps
+        m_MoveCond.wait_for(lock, std::chrono::milliseconds(std::min<long long>(llDeadlineMs - llNow, MOVE_POLL_INTERVAL)));
     }
+    return PLUGIN_OK;
+}
 
+long long CPegasusIndigo::getSettledTime()
+{
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    return m_llSettledMs;
+}
 
-    nErr = parseFields(sResp, vFieldsData, ':');
-    if(nErr) {
+int CPegasusIndigo::getSettleWindow(int nSlot)
+{
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    return settleWindowLocked(nSlot);
+}
+
+// m_StatusMutex held
+int CPegasusIndigo::settleWindowLocked(int nSlot)
+{
+    // the filter table settle time is a floor, the learned window can only make it longer
+    return std::max(m_SettleModel.getWindowMs(nSlot), m_FilterTable.getSettleMs(nSlot));
+}
+
+// m_StatusMutex held, called with every WR/WF sample
+void CPegasusIndigo::updateSettle(bool bMoving, int nSlot, long long llNowMs)
+{
+    bool bStable;
+
+    if(!m_bSettling) {
+        // nothing pending, or the wheel is still on its way
+        if(m_llSettledMs >= 0 || m_nTargetFilterSlot <= 0)
+            return;
+        if(m_bStatusMoving && m_nCurentFilterSlot != m_nTargetFilterSlot)
+            return;
+        m_bSettling = true;
+        m_bSettleRelapsed = false;
+        m_nSettleSlot = nSlot;
+        m_llStableSinceMs = bMoving ? -1 : llNowMs;
+        return;
+    }
+
+    // stopped, and on the same slot as last time we looked
+    bStable = !bMoving && nSlot == m_nSettleSlot;
+    m_nSettleSlot = nSlot;
+    if(!bStable) {
+        if(m_llStableSinceMs >= 0) {
+            m_SettleModel.noteRelapse(m_nTargetFilterSlot, int(llNowMs - m_llStableSinceMs));
+            m_bSettleRelapsed = true;
+        }
+        m_llStableSinceMs = -1;
+        return;
+    }
+    if(m_llStableSinceMs < 0)
+        m_llStableSinceMs = llNowMs;
+
+    if(llNowMs - m_llStableSinceMs >= settleWindowLocked(m_nTargetFilterSlot)) {
+        m_bSettling = false;
+        // it's been still since the first stable sample, the window only confirmed it
+        m_llSettledMs = m_llStableSinceMs;
+        m_SettleModel.noteSettled(m_nTargetFilterSlot, m_bSettleRelapsed);
+        traceMoveEnd();
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isMoveToComplete] Errorparsing response : " << nErr << std::endl;
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [updateSettle] slot " << nSlot << " settled at " << m_llSettledMs << (m_bSettleRelapsed ? " after a relapse" : "") << std::endl;
         m_sLogFile.flush();
 #endif
-        return nErr;
     }
+}
 
-    if(vFieldsData.size()>1 && vFieldsData[1] == "0")
-        bComplete = true;
-    else
-        bComplete = false;
+// m_StatusMutex held. The move shows on its own track from the WM to the settled wheel
+void CPegasusIndigo::traceMoveBegin(int nTargetPosition)
+{
+    static std::atomic<unsigned long long> nNextId(1);
+    char szSlot[TRACE_ARG_SIZE];
+
+    traceMoveEnd();
+    if(!CIndigoTrace::instance().isEnabled())
+        return;
+    // a move to the current slot is already over
+    if(m_llSettledMs >= 0)
+        return;
+    m_nMoveTraceId = nNextId++;
+    snprintf(szSlot, TRACE_ARG_SIZE, "%d", nTargetPosition);
+    CIndigoTrace::instance().asyncBegin("move", TRACE_CAT_MOVE, m_nMoveTraceId, "slot", szSlot);
+}
 
-    // check that we are on the right slot
-    nErr = getCurrentSlot(nFilterSlot);
-    if(nErr) {
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isMoveToComplete] Error Getting current slot : " << nErr << std::endl;
-        m_sLogFile.flush();
-#endif
+// m_StatusMutex held
+void CPegasusIndigo::traceMoveEnd()
+{
+    if(!m_nMoveTraceId)
+        return;
+    CIndigoTrace::instance().asyncEnd("move", TRACE_CAT_MOVE, m_nMoveTraceId);
+    m_nMoveTraceId = 0;
+}
+
+void CPegasusIndigo::setMoveCompleteCallback(IndigoMoveCallback pCallback, void *pContext)
+{
+    std::lock_guard<std::mutex> lock(m_CallbackMutex);
+    m_pMoveCallback = pCallback;
+    m_pMoveCallbackContext = pContext;
+}
+
+int CPegasusIndigo::refreshStatus()
+{
+    int nErr = PLUGIN_OK;
+    std::vector<std::string> vCmds = {"WR\n", "WF\n"};
+    std::vector<std::string> vResps;
+    std::vector<std::string> vFieldsData;
+    bool bMoving;
+    int nSlot;
+    bool bReached = false;
+
+    if(!m_bIsConnected)
+        return ERR_COMMNOLINK;
+
+    CIndigoSchedulerLock PortLock(m_Scheduler, PRIORITY_MOTION_STATUS);
+    nErr = sendCommands(vCmds, vResps, MAX_TIMEOUT, PRIORITY_MOTION_STATUS);
+    if(nErr)
+        return nErr;
 
+    // WR:0 when the wheel is not moving
+    nErr = parseFields(vResps[0], vFieldsData, ':');
+    if(nErr || vFieldsData.size() < 2 || vFieldsData[0] != "WR") {
+        setLastError(PLUGIN_BAD_CMD_RESPONSE);
+        return PLUGIN_BAD_CMD_RESPONSE;
     }
+    bMoving = (vFieldsData[1] != "0");
 
-    if(nFilterSlot == m_nTargetFilterSlot) {
-        bComplete = true;
-        m_nCurentFilterSlot = nFilterSlot;
+    nErr = parseFields(vResps[1], vFieldsData, ':');
+    if(nErr || vFieldsData.size() < 2 || vFieldsData[0] != "WF") {
+        setLastError(PLUGIN_BAD_CMD_RESPONSE);
+        return PLUGIN_BAD_CMD_RESPONSE;
     }
+    nSlot = atoi(vFieldsData[1].c_str());
+    noteSlot(nSlot);
 
-#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
-    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [isMoveToComplete] bComplete : " << (bComplete?"Yes":"No") << std::endl;
-    m_sLogFile.flush();
-#endif
+    {
+        std::lock_guard<std::mutex> lock(m_StatusMutex);
+        m_bStatusMoving = bMoving;
+        m_nStatusSlot = nSlot;
+        m_llStatusTimeMs = m_pClock->nowMs();
+        if(m_nStatusSlot == m_nTargetFilterSlot && m_nCurentFilterSlot != m_nTargetFilterSlot) {
+            m_nCurentFilterSlot = m_nStatusSlot;
+            bReached = true;
+        }
+        updateSettle(bMoving, nSlot, m_llStatusTimeMs);
+    }
+    if(bReached)
+        recordMoveTime();
 
     return nErr;
 }
 
+int CPegasusIndigo::getStatusSnapshot(IndigoStatusSnapshot &Snapshot, int nMaxAgeMs)
+{
+    int nErr = PLUGIN_OK;
+    long long llNow;
+
+    long long llStatusTime;
+
+    memset(&Snapshot, 0, sizeof(Snapshot));
+
+    {
+        std::lock_guard<std::mutex> lock(m_StatusMutex);
+        llStatusTime = m_llStatusTimeMs;
+    }
+    llNow = m_pClock->nowMs();
+    if(m_bIsConnected && (llStatusTime < 0 || llNow - llStatusTime > nMaxAgeMs)) {
+        // on error we still report what we have, with its age and the error
+        nErr = refreshStatus();
+        llNow = m_pClock->nowMs();
+    }
+
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    Snapshot.bConnected = m_bIsConnected;
+    Snapshot.nCurrentSlot = m_nStatusSlot > 0 ? m_nStatusSlot : m_nCurentFilterSlot;
+    Snapshot.nTargetSlot = m_nTargetFilterSlot;
+    Snapshot.bMoving = m_bStatusMoving && m_bIsConnected;
+    snprintf(Snapshot.szFirmware, STATUS_FIRMWARE_SIZE, "%s", m_sFirmwareVersion.c_str());
+    Snapshot.nLastError = m_nLastError;
+    Snapshot.nAgeMs = m_llStatusTimeMs < 0 ? -1 : int(llNow - m_llStatusTimeMs);
+    Snapshot.nSettledAgeMs = (m_bSettling || m_llSettledMs < 0) ? -1 : int(llNow - m_llSettledMs);
+
+    return nErr;
+}
+
+
+bool CPegasusIndigo::isMoveInProgress()
+{
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    return moveInProgressLocked();
+}
+
+// m_StatusMutex held
+bool CPegasusIndigo::moveInProgressLocked()
+{
+    // a move isn't over until the wheel has settled
+    return m_bSettling || (m_bStatusMoving && m_nTargetFilterSlot > 0 && m_nCurentFilterSlot != m_nTargetFilterSlot);
+}
+
+void CPegasusIndigo::setLastError(int nErr)
+{
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    m_nLastError = nErr;
+}
+
 
 #pragma mark - filters and device params functions
 int CPegasusIndigo::getFilterCount(int &nCount)
 {
-    nCount = 7;
+    nCount = m_nFilterCount;
     return PLUGIN_OK;
 }
 
+void CPegasusIndigo::setFilterCount(int nCount)
+{
+    if(nCount < 1 || nCount > FILTER_TABLE_MAX_SLOTS)
+        return;
+    m_nFilterCount = nCount;
+}
+
+int CPegasusIndigo::defaultFilterCount(const std::string &sFirmware)
+{
+    if(sFirmware == SIM_FIRMWARE)
+        return SIM_NB_SLOTS;
+    return INDIGO_NB_SLOTS;
+}
+
+void CPegasusIndigo::noteSlot(int nSlot)
+{
+    int nCount = m_nFilterCount;
+
+    // a wheel with more slots than we thought
+    while(nSlot > nCount && nSlot <= FILTER_TABLE_MAX_SLOTS) {
+        if(m_nFilterCount.compare_exchange_weak(nCount, nSlot))
+            break;
+    }
+}
+
 
 int CPegasusIndigo::getCurrentSlot(int &nSlot)
 {
@@ -403,7 +891,7 @@ int CPegasusIndigo::getCurrentSlot(int &nSlot)
     std::vector<std::string> vFieldsData;
 
 
-    nErr = sendCommand("WF\n", sResp);
+    nErr = sendCommand("WF\n", sResp, MAX_TIMEOUT, PRIORITY_MOTION_STATUS);
     if(nErr) {
 #if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
         m_sLogFile << "["<<getTimeStamp()<<"]"<< " [moveToFilterIndex] Error Getting response from sendCommand : " << nErr << std::endl;
@@ -424,6 +912,7 @@ int CPegasusIndigo::getCurrentSlot(int &nSlot)
 
     if(vFieldsData.size()>1) {
         nSlot = std::stoi(vFieldsData[1]);
+        noteSlot(nSlot);
     }
     else {
         nErr = PLUGIN_COMMAND_FAILED;
@@ -436,6 +925,386 @@ int CPegasusIndigo::getCurrentSlot(int &nSlot)
     return nErr;
 }
 
+#pragma mark - move monitor
+
+void CPegasusIndigo::startMoveMonitor()
+{
+    // a move started from the completion callback, the monitor is running and
+    // stopMoveMonitor may be holding the mutex while it waits for us
+    if(std::this_thread::get_id() == m_MonitorThreadId)
+        return;
+
+    std::lock_guard<std::mutex> lock(m_MonitorMutex);
+    if(m_MonitorThread.joinable())
+        return;
+    m_bMonitorStop = false;
+    m_MonitorThread = std::thread(&CPegasusIndigo::moveMonitorLoop, this);
+}
+
+void CPegasusIndigo::stopMoveMonitor()
+{
+    std::lock_guard<std::mutex> lock(m_MonitorMutex);
+    if(!m_MonitorThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> StatusLock(m_StatusMutex);
+        m_bMonitorStop = true;
+    }
+    m_MonitorCond.notify_all();
+    m_MonitorThread.join();
+    // waiters see the move as abandoned
+    m_MoveCond.notify_all();
+}
+
+void CPegasusIndigo::moveMonitorLoop()
+{
+    int nErr;
+    int nSlot;
+    int nWaitMs;
+    bool bDone;
+    IndigoMoveCallback pCallback;
+    void *pContext;
+
+    m_MonitorThreadId = std::this_thread::get_id();
+    CIndigoTrace::instance().threadName("move monitor");
+    std::unique_lock<std::mutex> lock(m_StatusMutex);
+    while(!m_bMonitorStop) {
+        m_MonitorCond.wait(lock, [&] { return m_bMonitorStop || moveInProgressLocked(); });
+        if(m_bMonitorStop)
+            break;
+
+        nWaitMs = m_bSettling ? SETTLE_POLL_INTERVAL : MOVE_POLL_INTERVAL;
+        lock.unlock();
+        m_pClock->sleepMs(nWaitMs);
+        nErr = refreshStatus();
+        lock.lock();
+
+        m_nMoveError = nErr;
+        bDone = !nErr && !moveInProgressLocked();
+        nSlot = m_nStatusSlot;
+        m_MoveCond.notify_all();
+        if(!bDone)
+            continue;
+
+        lock.unlock();
+        {
+            std::lock_guard<std::mutex> CallbackLock(m_CallbackMutex);
+            pCallback = m_pMoveCallback;
+            pContext = m_pMoveCallbackContext;
+        }
+        if(pCallback)
+            pCallback(pContext, nSlot);
+        lock.lock();
+    }
+    m_MonitorThreadId = std::thread::id();
+}
+
+
+#pragma mark - heartbeat
+
+void CPegasusIndigo::setHeartbeatInterval(int nIntervalMs)
+{
+    m_nHeartbeatInterval = std::max(nIntervalMs, 0);
+    // pick up the new interval now rather than after the current wait
+    m_HeartbeatCond.notify_all();
+}
+
+void CPegasusIndigo::startHeartbeat()
+{
+    if(!m_nHeartbeatInterval || m_HeartbeatThread.joinable())
+        return;
+
+    m_bHeartbeatStop = false;
+    m_nHeartbeatFailures = 0;
+    m_nReconnectDelay = HEARTBEAT_RETRY_DELAY;
+    m_llLastExchangeMs = m_pClock->nowMs();
+    m_HeartbeatThread = std::thread(&CPegasusIndigo::heartbeatLoop, this);
+}
+
+void CPegasusIndigo::stopHeartbeat()
+{
+    if(!m_HeartbeatThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_HeartbeatMutex);
+        m_bHeartbeatStop = true;
+    }
+    m_HeartbeatCond.notify_all();
+    m_HeartbeatThread.join();
+}
+
+void CPegasusIndigo::heartbeatLoop()
+{
+    int nWaitMs = m_nHeartbeatInterval;
+    std::unique_lock<std::mutex> lock(m_HeartbeatMutex);
+
+    m_HeartbeatThreadId = std::this_thread::get_id();
+    CIndigoTrace::instance().threadName("heartbeat");
+    // waits are on the condition variable so stopHeartbeat doesn't have to sit through them,
+    // idle time is measured on the driver clock
+    while(!m_bHeartbeatStop) {
+        m_HeartbeatCond.wait_for(lock, std::chrono::milliseconds(nWaitMs), [&] { return m_bHeartbeatStop; });
+        if(m_bHeartbeatStop)
+            break;
+        lock.unlock();
+        nWaitMs = heartbeat();
+        lock.lock();
+    }
+    m_HeartbeatThreadId = std::thread::id();
+}
+
+// returns how long to wait before the next check
+int CPegasusIndigo::heartbeat()
+{
+    int nErr;
+    int nInterval = m_nHeartbeatInterval;
+    long long llIdleMs;
+    std::string sResp;
+
+    if(!nInterval)
+        return HEARTBEAT_RETRY_DELAY;
+
+    if(!m_bLinkLost) {
+        // the host is polling, that keeps the adapter awake and tells us soon enough if the link dies
+        llIdleMs = m_pClock->nowMs() - m_llLastExchangeMs;
+        if(llIdleMs < nInterval)
+            return int(nInterval - llIdleMs);
+        if(isMoveInProgress())
+            return nInterval;
+
+        nErr = sendCommand("W#\n", sResp, HEARTBEAT_TIMEOUT, PRIORITY_INFO);
+        if(!nErr && sResp.find("FW_OK") != std::string::npos) {
+            m_nHeartbeatFailures = 0;
+            return nInterval;
+        }
+        if(++m_nHeartbeatFailures < HEARTBEAT_MAX_FAILURES)
+            return HEARTBEAT_RETRY_DELAY;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [heartbeat] link lost, error " << nErr << std::endl;
+        m_sLogFile.flush();
+#endif
+        m_bLinkLost = true;
+        setLastError(ERR_COMMNOLINK);
+        m_nReconnectDelay = HEARTBEAT_RETRY_DELAY;
+    }
+
+    if(reconnect() == PLUGIN_OK) {
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [heartbeat] link recovered" << std::endl;
+        m_sLogFile.flush();
+#endif
+        m_nHeartbeatFailures = 0;
+        m_bLinkLost = false;
+        setLastError(PLUGIN_OK);
+        return nInterval;
+    }
+    m_nReconnectDelay = std::min(m_nReconnectDelay * 2, HEARTBEAT_MAX_BACKOFF);
+    return m_nReconnectDelay;
+}
+
+int CPegasusIndigo::reconnect()
+{
+    int nErr;
+    std::string sResp;
+
+    CIndigoSchedulerLock PortLock(m_Scheduler, PRIORITY_INFO);
+    if(!m_bIsConnected)
+        return ERR_COMMNOLINK;
+
+    // a USB adapter that went away comes back as a new device, the old handle is useless
+    m_pPort->close();
+    if(m_pPort->open(m_sPortName.c_str()))
+        return ERR_COMMNOLINK;
+
+    nErr = sendCommand("W#\n", sResp, HEARTBEAT_TIMEOUT, PRIORITY_INFO);
+    if(nErr)
+        return nErr;
+    if(sResp.find("FW_OK") == std::string::npos)
+        return PLUGIN_COMMAND_FAILED;
+    return PLUGIN_OK;
+}
+
+bool CPegasusIndigo::linkLostFor(std::thread::id CallerId)
+{
+    // the heartbeat thread is the one allowed to talk to a lost link, to bring it back
+    return m_bLinkLost && CallerId != m_HeartbeatThreadId;
+}
+
+
+#pragma mark - link grace period
+
+// port lock held, the port is still open from before Disconnect
+int CPegasusIndigo::relink()
+{
+    int nErr;
+    int nSlot = -1;
+
+    setLastError(PLUGIN_OK);
+    m_bLinkLost = false;
+    m_pPort->purgeTxRx();
+    // firmware, filter count and the learned tables are still valid, the slot is all we need
+    nErr = getCurrentSlot(nSlot);
+    if(nErr)
+        return nErr;
+    m_bIsConnected = true;
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [relink] re-linked on the open port, slot " << nSlot << std::endl;
+    m_sLogFile.flush();
+#endif
+
+    std::lock_guard<std::mutex> lock(m_StatusMutex);
+    m_nCurentFilterSlot = nSlot;
+    m_nStatusSlot = nSlot;
+    m_bStatusMoving = false;
+    m_llStatusTimeMs = m_pClock->nowMs();
+    m_llSettledMs = m_llStatusTimeMs;
+    startHeartbeat();
+    return PLUGIN_OK;
+}
+
+void CPegasusIndigo::releaseParkedPort()
+{
+    stopGraceTimer();
+    CIndigoSchedulerLock PortLock(m_Scheduler, PRIORITY_MOTION);
+    closeParkedPort();
+}
+
+// port lock held
+void CPegasusIndigo::closeParkedPort()
+{
+    if(!m_bParked)
+        return;
+    m_bParked = false;
+    m_pPort->purgeTxRx();
+    m_pPort->close();
+}
+
+void CPegasusIndigo::startGraceTimer()
+{
+    if(m_GraceThread.joinable())
+        return;
+    m_bGraceStop = false;
+    m_GraceThread = std::thread(&CPegasusIndigo::graceLoop, this);
+}
+
+void CPegasusIndigo::stopGraceTimer()
+{
+    if(!m_GraceThread.joinable())
+        return;
+    {
+        std::lock_guard<std::mutex> lock(m_GraceMutex);
+        m_bGraceStop = true;
+    }
+    m_GraceCond.notify_all();
+    m_GraceThread.join();
+}
+
+void CPegasusIndigo::graceLoop()
+{
+    std::unique_lock<std::mutex> lock(m_GraceMutex);
+
+    CIndigoTrace::instance().threadName("link grace");
+    if(m_GraceCond.wait_for(lock, std::chrono::milliseconds(m_nLinkGracePeriod), [&] { return m_bGraceStop; }))
+        return;
+    lock.unlock();
+
+    CIndigoSchedulerLock PortLock(m_Scheduler, PRIORITY_INFO);
+    closeParkedPort();
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [graceLoop] grace period over, port closed" << std::endl;
+    m_sLogFile.flush();
+#endif
+}
+
+
+#pragma mark - move time trend
+
+void CPegasusIndigo::recordMoveTime()
+{
+    int nDuration;
+    MoveTimeStats Stats;
+
+    if(!m_bMoveTimed)
+        return;
+    m_bMoveTimed = false;
+
+    nDuration = int(m_pClock->nowMs() - m_llMoveStartMs);
+    m_MoveStats.recordMove(m_nMoveFromSlot, m_nTargetFilterSlot, nDuration);
+    m_MoveStats.getStats(m_nMoveFromSlot, m_nTargetFilterSlot, Stats);
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [recordMoveTime] " << m_nMoveFromSlot << " -> " << m_nTargetFilterSlot << " : " << nDuration << " ms, baseline " << Stats.dBaselineMs << " ms, drift " << Stats.dDriftPercent << " %" << std::endl;
+    if(Stats.bFlagged)
+        m_sLogFile << "["<<getTimeStamp()<<"]"<< " [recordMoveTime] WARNING move " << m_nMoveFromSlot << " -> " << m_nTargetFilterSlot << " is getting slower, check the wheel mechanics." << std::endl;
+    m_sLogFile.flush();
+#endif
+}
+
+int CPegasusIndigo::getMoveTimeStats(int nFromSlot, int nToSlot, MoveTimeStats &Stats)
+{
+    if(!m_MoveStats.getStats(nFromSlot, nToSlot, Stats))
+        return PLUGIN_COMMAND_FAILED;
+    return PLUGIN_OK;
+}
+
+int CPegasusIndigo::getWornTransitions(std::vector<std::pair<int,int>> &vTransitions)
+{
+    m_MoveStats.getFlaggedTransitions(vTransitions);
+    return PLUGIN_OK;
+}
+
+#pragma mark - filter order
+
+int CPegasusIndigo::getFilterOrder(const std::vector<int> &vSlots, int nCurrentSlot, std::vector<int> &vOrder, int &nTotalMs)
+{
+    int nSlots = m_nFilterCount;
+    CIndigoFilterOrder Order(nSlots);
+    MoveTimeStats Stats;
+    std::vector<std::pair<int,int>> vUnmeasured;
+    double dMeasuredMs = 0;
+    double dModelMs = 0;
+    double dScale = 1.0;
+
+    if(nCurrentSlot < 1) {
+        std::lock_guard<std::mutex> lock(m_StatusMutex);
+        nCurrentSlot = m_nStatusSlot > 0 ? m_nStatusSlot : m_nCurentFilterSlot;
+    }
+
+    // measured times first, the recent average so a wearing transition costs what it costs now
+    for(int nFrom = 1; nFrom <= nSlots; nFrom++) {
+        for(int nTo = 1; nTo <= nSlots; nTo++) {
+            if(nFrom == nTo)
+                continue;
+            if(m_MoveStats.getStats(nFrom, nTo, Stats) && Stats.dRecentMs > 0) {
+                Order.setCost(nFrom, nTo, int(Stats.dRecentMs + 0.5));
+                dMeasuredMs += Stats.dRecentMs;
+                dModelMs += CIndigoFilterOrder::modelCost(nFrom, nTo, nSlots);
+            }
+            else
+                vUnmeasured.push_back(std::make_pair(nFrom, nTo));
+        }
+    }
+    // the rest from the model, scaled by how this wheel compares to it on what we did measure
+    if(dModelMs > 0)
+        dScale = dMeasuredMs / dModelMs;
+    for(const std::pair<int,int> &Transition : vUnmeasured)
+        Order.setCost(Transition.first, Transition.second, int(CIndigoFilterOrder::modelCost(Transition.first, Transition.second, nSlots) * dScale + 0.5));
+
+    nTotalMs = Order.optimize(nCurrentSlot, vSlots, vOrder);
+    if(nTotalMs < 0) {
+        nTotalMs = 0;
+        return PLUGIN_COMMAND_FAILED;
+    }
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [getFilterOrder] " << vSlots.size() << " filters from slot " << nCurrentSlot << " : " << nTotalMs << " ms, model scale " << dScale << std::endl;
+    m_sLogFile.flush();
+#endif
+    return PLUGIN_OK;
+}
+
 int CPegasusIndigo::parseFields(const std::string szIn, std::vector<std::string> &svFields, char cSeparator)
 {
     int nErr = PLUGIN_OK;
@@ -474,6 +1343,30 @@ std::string& CPegasusIndigo::rtrim(std::string& str, const std::string& filter)
 
 
 #ifdef PLUGIN_DEBUG
+void CPegasusIndigo::openLog()
+{
+    if(m_sLogFile.is_open())
+        return;
+
+#if defined(SB_WIN_BUILD)
+    m_sLogfilePath = getenv("HOMEDRIVE");
+    m_sLogfilePath += getenv("HOMEPATH");
+    m_sLogfilePath += "\\PegasusIndigoLog.txt";
+#elif defined(SB_LINUX_BUILD)
+    m_sLogfilePath = getenv("HOME");
+    m_sLogfilePath += "/PegasusIndigoLog.txt";
+#elif defined(SB_MAC_BUILD)
+    m_sLogfilePath = getenv("HOME");
+    m_sLogfilePath += "/PegasusIndigoLog.txt";
+#endif
+    m_sLogFile.open(m_sLogfilePath, std::ios::out |std::ios::trunc);
+
+#if defined PLUGIN_DEBUG && PLUGIN_DEBUG >= 2
+    m_sLogFile << "["<<getTimeStamp()<<"]"<< " [openLog] Version " << std::fixed << std::setprecision(2) << PLUGIN_VERSION << " build " << __DATE__ << " " << __TIME__ << std::endl;
+    m_sLogFile.flush();
+#endif
+}
+
 const std::string CPegasusIndigo::getTimeStamp()
 {
     time_t     now = time(0);
@@ -32,11 +32,23 @@
 #include <cmath>
 #include <iomanip>
 #include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <condition_variable>
 
 
 #include "../../licensedinterfaces/sberrorx.h"
 #include "../../licensedinterfaces/serxinterface.h"
 
+#include "IndigoPort.h"
+#include "IndigoMoveStats.h"
+#include "IndigoStatusInterface.h"
+#include "IndigoScheduler.h"
+#include "IndigoFilterTable.h"
+#include "IndigoSettle.h"
+#include "IndigoFilterOrder.h"
+#include "IndigoTrace.h"
+
 // #define PLUGIN_DEBUG 2
 #define PLUGIN_VERSION      1.0
 
@@ -48,6 +60,23 @@
 #define MAX_READ_WAIT_TIMEOUT 25
 #define NB_RX_WAIT 10
 
+#define HEARTBEAT_INTERVAL      5000    // ms of silence on the link before we check it, 0 to disable
+#define HEARTBEAT_TIMEOUT       500
+#define HEARTBEAT_MAX_FAILURES  2       // missed heartbeats before the link is declared lost
+#define HEARTBEAT_RETRY_DELAY   1000    // ms, first retry / reconnect delay, doubled on each failure
+#define HEARTBEAT_MAX_BACKOFF   60000
+
+#define MOVE_POLL_INTERVAL      100     // ms between two WR/WF exchanges of the move monitor
+
+#define LINK_GRACE_PERIOD       0       // ms the port stays open after Disconnect for a quick re-link, 0 to close right away
+
+#define INDIGO_NB_SLOTS     7       // every Indigo firmware so far, the protocol has no slot count query
+
+// called from the move monitor thread when a move ends, nSlot is the device slot (1 based).
+// It can start another move, the running monitor follows it. It must not Connect or Disconnect,
+// both join the monitor thread and it would wait for itself.
+typedef void (*IndigoMoveCallback)(void *pContext, int nSlot);
+
 enum PegasusIndigoFilterWheelErrors {PLUGIN_OK=0, PLUGIN_NOT_CONNECTED, PLUGIN_CANT_CONNECT, PLUGIN_BAD_CMD_RESPONSE, PLUGIN_COMMAND_FAILED, PLUGIN_COMMAND_TIMEOUT};
 
 class CPegasusIndigo
@@ -60,39 +89,195 @@ public:
     void            Disconnect(void);
     bool            IsConnected(void) { return m_bIsConnected; };
 
-    void            SetSerxPointer(SerXInterface *p) { m_pSerx = p; };
+    void            SetSerxPointer(SerXInterface *p) { m_SerxPort.setSerx(p); };
+    void            setClock(CIndigoClock *pClock);
+    CIndigoClock    *getClock() { return m_pClock; };
+    void            setTransport(int nTransport);
+    void            setPort(CIndigoPort *pPort) { m_pCustomPort = pPort; };    // overrides the transport setting, NULL to clear
+    int             getTransport() { return m_nTransport; };
 
     // filter wheel communication
-    int             sendCommand(const std::string sCmd, std::string &sResp, int nTimeout = MAX_TIMEOUT);
-    int             readResponse(std::string &sResult, int nTimeout = MAX_TIMEOUT);
+    int             sendCommand(const std::string sCmd, std::string &sResp, int nTimeout = MAX_TIMEOUT, int nPriority = PRIORITY_INFO);
+    int             sendCommands(const std::vector<std::string> &vCmds, std::vector<std::string> &vResps, int nTimeout = MAX_TIMEOUT, int nPriority = PRIORITY_MOTION_STATUS);
+    int             readResponse(std::string &sResult, int nTimeout = MAX_TIMEOUT, int nLines = 1);
 
     // Filter Wheel commands
     int             getFirmwareVersion(std::string &sVersion);
+    // as read by the last Connect, no I/O
+    std::string     getCachedFirmwareVersion();
     int             getStatus();
     
     int             moveToFilterIndex(int nTargetPosition);
     int             isMoveToComplete(bool &bComplete);
+    // blocks until the wheel stops, llDeadlineMs is on the driver clock (getClock()->nowMs())
+    int             waitForMoveComplete(long long llDeadlineMs);
+    void            setMoveCompleteCallback(IndigoMoveCallback pCallback, void *pContext);
+    // when the wheel was confirmed stable after the last move, on the driver clock. -1 while moving or settling
+    long long       getSettledTime();
+    int             getSettleWindow(int nSlot);
 
     int             getFilterCount(int &nCount);
+    void            setFilterCount(int nCount);
     int             getCurrentSlot(int &nSlot);
 
+    // per slot metadata, read without locking once frozen
+    CIndigoFilterTable &getFilterTable() { return m_FilterTable; };
+
+    // everything in one call, device slot numbers (1 based)
+    int             getStatusSnapshot(IndigoStatusSnapshot &Snapshot, int nMaxAgeMs = STATUS_CACHE_MAX_AGE);
+
+    // move time trend, for wear detection
+    int             getMoveTimeStats(int nFromSlot, int nToSlot, MoveTimeStats &Stats);
+    int             getWornTransitions(std::vector<std::pair<int,int>> &vTransitions);
+    void            setMoveTimeDriftThreshold(double dPercent) { m_MoveStats.setDriftThreshold(dPercent); };
+    CIndigoMoveStats &getMoveStats() { return m_MoveStats; };
+
+    // cheapest order to visit vSlots (repeats allowed), device slots (1 based), from nCurrentSlot
+    // or the wheel's current slot when < 1. nTotalMs is the estimated travel time.
+    int             getFilterOrder(const std::vector<int> &vSlots, int nCurrentSlot, std::vector<int> &vOrder, int &nTotalMs);
+
+    // background link check, only talks to the wheel when nobody else has for a while
+    void            setHeartbeatInterval(int nIntervalMs);
+    int             getHeartbeatInterval() { return m_nHeartbeatInterval; };
+    bool            isLinkLost() { return m_bLinkLost; };
+
+    // a Connect to the same port within the grace period after Disconnect reuses the open port
+    // and only checks the wheel with one query
+    void            setLinkGracePeriod(int nPeriodMs) { m_nLinkGracePeriod = std::max(nPeriodMs, 0); };
+    int             getLinkGracePeriod() { return m_nLinkGracePeriod; };
+    // closes a port kept open by the grace period now
+    void            releaseParkedPort();
+
+    // worst wait for the port seen by each priority class, in ms
+    long long       getCommandMaxWaitMs(int nPriority) { return m_Scheduler.getMaxWaitMs(nPriority); };
+
 protected:
-    SerXInterface   *m_pSerx;
+    CIndigoPort     *m_pPort;
+    CIndigoPort     *m_pCustomPort;
+    CIndigoSerXPort m_SerxPort;
+    CIndigoSimPort  m_SimPort;
+#ifdef SB_LINUX_BUILD
+    CIndigoTermiosPort m_TermiosPort;
+    CIndigoBrokerPort  m_BrokerPort;
+#endif
+    int             m_nTransport;
+
+    CIndigoClock    *m_pClock;
+    CSteadyClock    m_SteadyClock;
+
+    std::atomic<bool> m_bIsConnected;
 
-    bool            m_bIsConnected;
+    // port access, moves go first
+    CIndigoScheduler m_Scheduler;
+    std::atomic<long long> m_llLastExchangeMs;
 
+    // heartbeat
+    std::string     m_sPortName;
+    std::thread     m_HeartbeatThread;
+    // set by the heartbeat thread itself, other threads assign and join m_HeartbeatThread
+    std::atomic<std::thread::id> m_HeartbeatThreadId;
+    std::mutex      m_HeartbeatMutex;
+    std::condition_variable m_HeartbeatCond;
+    bool            m_bHeartbeatStop;
+    std::atomic<int> m_nHeartbeatInterval;
+    std::atomic<bool> m_bLinkLost;
+    int             m_nHeartbeatFailures;
+    int             m_nReconnectDelay;
+
+    void            startHeartbeat();
+    void            stopHeartbeat();
+    void            heartbeatLoop();
+    int             heartbeat();
+    int             reconnect();
+    bool            linkLostFor(std::thread::id CallerId);
+
+    // port kept open after Disconnect, closed by the grace timer unless Connect picks it up
+    std::atomic<int> m_nLinkGracePeriod;
+    bool            m_bParked;
+    std::thread     m_GraceThread;
+    std::mutex      m_GraceMutex;
+    std::condition_variable m_GraceCond;
+    bool            m_bGraceStop;
+
+    int             relink();
+    void            closeParkedPort();
+    void            startGraceTimer();
+    void            stopGraceTimer();
+    void            graceLoop();
+
+    // cached state, shared between threads
+    std::mutex      m_StatusMutex;
     std::string     m_sFirmwareVersion;
+    int             m_nLastError;
+
+    // last WR/WF exchange
+    bool            m_bStatusMoving;
+    int             m_nStatusSlot;
+    long long       m_llStatusTimeMs;
+
+    std::string     moveCommand(int nTargetPosition);
+    int             refreshStatus();
+    bool            isMoveInProgress();
+    bool            moveInProgressLocked();
+
+    // settle confirmation, m_StatusMutex held
+    bool            m_bSettling;
+    bool            m_bSettleRelapsed;
+    int             m_nSettleSlot;          // slot seen on the previous poll
+    long long       m_llStableSinceMs;
+    long long       m_llSettledMs;
+    CIndigoSettleModel m_SettleModel;
+
+    void            updateSettle(bool bMoving, int nSlot, long long llNowMs);
+    int             settleWindowLocked(int nSlot);
 
+    // trace of the current move, 0 when none is open
+    unsigned long long m_nMoveTraceId;
+
+    void            traceMoveBegin(int nTargetPosition);
+    void            traceMoveEnd();
+
+    // move monitor, a single poller for isMoveToComplete, waiters and the callback
+    std::mutex      m_MonitorMutex;         // start / stop of the thread
+    std::thread     m_MonitorThread;
+    std::atomic<std::thread::id> m_MonitorThreadId;    // set by the monitor thread itself
+    std::condition_variable m_MonitorCond;  // with m_StatusMutex, a move started or stop was requested
+    std::condition_variable m_MoveCond;     // with m_StatusMutex, the monitor has fresh status
+    bool            m_bMonitorStop;
+    int             m_nMoveError;
+    std::mutex      m_CallbackMutex;
+    IndigoMoveCallback m_pMoveCallback;
+    void            *m_pMoveCallbackContext;
+
+    void            startMoveMonitor();
+    void            stopMoveMonitor();
+    void            moveMonitorLoop();
+    void            setLastError(int nErr);
 
     int             m_nCurentFilterSlot;
     int             m_nTargetFilterSlot;
-    
+
+    // number of slots, from the firmware then raised by any higher slot the wheel reports
+    std::atomic<int> m_nFilterCount;
+    CIndigoFilterTable m_FilterTable;
+
+    int             defaultFilterCount(const std::string &sFirmware);
+    void            noteSlot(int nSlot);
+
+    // current move timing
+    bool            m_bMoveTimed;
+    int             m_nMoveFromSlot;
+    long long       m_llMoveStartMs;
+    CIndigoMoveStats m_MoveStats;
+
+    void            recordMoveTime();
     int             parseFields(const std::string szIn, std::vector<std::string> &svFields, char cSeparator);
     std::string&    trim(std::string &str, const std::string &filter );
     std::string&    ltrim(std::string &str, const std::string &filter);
     std::string&    rtrim(std::string &str, const std::string &filter);
 
 #ifdef PLUGIN_DEBUG
+    void            openLog();
     const std::string getTimeStamp();
     std::ofstream m_sLogFile;
     std::string m_sLogfilePath;
@@ -0,0 +1,239 @@
+//
+//  IndigoBench.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Minimal Google Benchmark style harness for the driver benchmarks.
+//  Results are printed as a table and, with --benchmark_out=<file>, written in
+//  Google Benchmark's JSON format so runs can be compared across commits.
+//  --benchmark_filter=<text> only runs the benchmarks whose name contains <text>.
+//  runManual() is Google Benchmark's UseManualTime, fn times the part that matters and setup
+//  and teardown stay out of the result.
+//  A benchmark that defines BENCH_COUNT_ALLOCATIONS before including this file replaces the
+//  global operator new, and every result gets allocs_per_iter and alloc_bytes_per_iter counters.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoBench_h
+#define IndigoBench_h
+
+#include <string.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+#include <map>
+#include <chrono>
+#include <ctime>
+#include <functional>
+#include <algorithm>
+#include <fstream>
+#include <atomic>
+#include <new>
+
+typedef struct {
+    std::atomic<long long>  nCount;
+    std::atomic<long long>  nBytes;
+} BenchAllocStats;
+
+inline BenchAllocStats &benchAllocStats()
+{
+    static BenchAllocStats Stats;
+    return Stats;
+}
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+#if defined(__GNUC__) && !defined(__clang__)
+// gcc sees the free() below paired with a new expression once everything is inlined
+#pragma GCC diagnostic ignored "-Wmismatched-new-delete"
+#endif
+void *operator new(size_t nSize)
+{
+    void *p;
+
+    benchAllocStats().nCount++;
+    benchAllocStats().nBytes += nSize;
+    p = malloc(nSize ? nSize : 1);
+    if(!p)
+        throw std::bad_alloc();
+    return p;
+}
+void *operator new[](size_t nSize) { return operator new(nSize); }
+void operator delete(void *p) noexcept { free(p); }
+void operator delete[](void *p) noexcept { free(p); }
+void operator delete(void *p, size_t) noexcept { free(p); }
+void operator delete[](void *p, size_t) noexcept { free(p); }
+#endif
+
+typedef struct {
+    std::string                     sName;
+    long long                       nIterations;
+    double                          dRealTimeNs;    // per iteration
+    double                          dCpuTimeNs;     // per iteration
+    std::map<std::string, double>   mCounters;
+} BenchResult;
+
+class CIndigoBench
+{
+public:
+    CIndigoBench(int argc, char **argv)
+    {
+        for(int i = 1; i < argc; i++) {
+            if(!strncmp(argv[i], "--benchmark_out=", 16))
+                m_sOutFile = argv[i] + 16;
+            else if(!strncmp(argv[i], "--benchmark_filter=", 19))
+                m_sFilter = argv[i] + 19;
+        }
+    };
+
+    // run fn nIterations times, per iteration latency percentiles are added as counters.
+    // The returned result (NULL if filtered out) stays valid until the next run().
+    BenchResult *run(const std::string &sName, long long nIterations, std::function<void()> fn)
+    {
+        BenchResult Result;
+        std::vector<double> vSamples;
+        std::chrono::steady_clock::time_point tStart, tIter;
+        std::clock_t tCpuStart;
+        double dTotalNs;
+#ifdef BENCH_COUNT_ALLOCATIONS
+        long long nAllocStart, nAllocBytesStart;
+#endif
+
+        if(!m_sFilter.empty() && sName.find(m_sFilter) == std::string::npos)
+            return NULL;
+
+        if(nIterations <= BENCH_MAX_SAMPLES)
+            vSamples.reserve(nIterations);
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+        nAllocStart = benchAllocStats().nCount;
+        nAllocBytesStart = benchAllocStats().nBytes;
+#endif
+        tCpuStart = std::clock();
+        tStart = std::chrono::steady_clock::now();
+        for(long long i = 0; i < nIterations; i++) {
+            tIter = std::chrono::steady_clock::now();
+            fn();
+            if(nIterations <= BENCH_MAX_SAMPLES)
+                vSamples.push_back(double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tIter).count()));
+        }
+        dTotalNs = double(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tStart).count());
+
+#ifdef BENCH_COUNT_ALLOCATIONS
+        Result.mCounters["allocs_per_iter"] = double(benchAllocStats().nCount - nAllocStart) / nIterations;
+        Result.mCounters["alloc_bytes_per_iter"] = double(benchAllocStats().nBytes - nAllocBytesStart) / nIterations;
+#endif
+        Result.sName = sName;
+        Result.nIterations = nIterations;
+        Result.dRealTimeNs = dTotalNs / nIterations;
+        Result.dCpuTimeNs = double(std::clock() - tCpuStart) / CLOCKS_PER_SEC * 1e9 / nIterations;
+        if(!vSamples.empty()) {
+            std::sort(vSamples.begin(), vSamples.end());
+            Result.mCounters["p50_ns"] = vSamples[vSamples.size() / 2];
+            Result.mCounters["p99_ns"] = vSamples[std::min(vSamples.size() - 1, vSamples.size() * 99 / 100)];
+            Result.mCounters["max_ns"] = vSamples.back();
+        }
+        m_vResults.push_back(Result);
+        return &m_vResults.back();
+    };
+
+    // fn returns the time of the measured part of the iteration, in ns
+    BenchResult *runManual(const std::string &sName, long long nIterations, std::function<long long()> fn)
+    {
+        BenchResult Result;
+        std::vector<double> vSamples;
+        std::clock_t tCpuStart;
+        double dTotalNs = 0;
+        double dSampleNs;
+
+        if(!m_sFilter.empty() && sName.find(m_sFilter) == std::string::npos)
+            return NULL;
+
+        tCpuStart = std::clock();
+        for(long long i = 0; i < nIterations; i++) {
+            dSampleNs = double(fn());
+            dTotalNs += dSampleNs;
+            if(nIterations <= BENCH_MAX_SAMPLES)
+                vSamples.push_back(dSampleNs);
+        }
+
+        Result.sName = sName + "/manual_time";
+        Result.nIterations = nIterations;
+        Result.dRealTimeNs = dTotalNs / nIterations;
+        // includes the setup and teardown
+        Result.dCpuTimeNs = double(std::clock() - tCpuStart) / CLOCKS_PER_SEC * 1e9 / nIterations;
+        if(!vSamples.empty()) {
+            std::sort(vSamples.begin(), vSamples.end());
+            Result.mCounters["p50_ns"] = vSamples[vSamples.size() / 2];
+            Result.mCounters["p99_ns"] = vSamples[std::min(vSamples.size() - 1, vSamples.size() * 99 / 100)];
+            Result.mCounters["max_ns"] = vSamples.back();
+        }
+        m_vResults.push_back(Result);
+        return &m_vResults.back();
+    };
+
+    int report()
+    {
+        printf("%-48s %14s %14s %12s\n", "Benchmark", "Time (ns)", "CPU (ns)", "Iterations");
+        for(const BenchResult &Result : m_vResults) {
+            printf("%-48s %14.0f %14.0f %12lld", Result.sName.c_str(), Result.dRealTimeNs, Result.dCpuTimeNs, Result.nIterations);
+            for(const auto &Counter : Result.mCounters)
+                printf(" %s=%.6g", Counter.first.c_str(), Counter.second);
+            printf("\n");
+        }
+        if(!m_sOutFile.empty())
+            return writeJson(m_sOutFile);
+        return 0;
+    };
+
+protected:
+    static const long long  BENCH_MAX_SAMPLES = 100000;
+
+    std::string             m_sOutFile;
+    std::string             m_sFilter;
+    std::vector<BenchResult> m_vResults;
+
+    int writeJson(const std::string &sPath)
+    {
+        std::ofstream JsonFile(sPath, std::ios::out | std::ios::trunc);
+        char szDate[64];
+        char szHost[256];
+        time_t tNow = time(NULL);
+
+        if(!JsonFile.is_open())
+            return 1;
+
+        strftime(szDate, sizeof(szDate), "%Y-%m-%dT%H:%M:%S", localtime(&tNow));
+        if(gethostname(szHost, sizeof(szHost)) != 0)
+            strcpy(szHost, "unknown");
+
+        JsonFile << "{\n  \"context\": {\n";
+        JsonFile << "    \"date\": \"" << szDate << "\",\n";
+        JsonFile << "    \"host_name\": \"" << szHost << "\",\n";
+        JsonFile << "    \"num_cpus\": " << sysconf(_SC_NPROCESSORS_ONLN) << ",\n";
+        JsonFile << "    \"library_build_type\": \"release\"\n  },\n";
+        JsonFile << "  \"benchmarks\": [\n";
+        for(size_t i = 0; i < m_vResults.size(); i++) {
+            const BenchResult &Result = m_vResults[i];
+            JsonFile << "    {\n";
+            JsonFile << "      \"name\": \"" << Result.sName << "\",\n";
+            JsonFile << "      \"run_name\": \"" << Result.sName << "\",\n";
+            JsonFile << "      \"run_type\": \"iteration\",\n";
+            JsonFile << "      \"iterations\": " << Result.nIterations << ",\n";
+            JsonFile << "      \"real_time\": " << Result.dRealTimeNs << ",\n";
+            JsonFile << "      \"cpu_time\": " << Result.dCpuTimeNs << ",\n";
+            for(const auto &Counter : Result.mCounters)
+                JsonFile << "      \"" << Counter.first << "\": " << Counter.second << ",\n";
+            JsonFile << "      \"time_unit\": \"ns\"\n";
+            JsonFile << "    }" << (i + 1 < m_vResults.size() ? "," : "") << "\n";
+        }
+        JsonFile << "  ]\n}\n";
+        return 0;
+    };
+};
+
+#endif /* IndigoBench_h */
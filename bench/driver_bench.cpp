@@ -0,0 +1,185 @@
+//
+//  driver_bench.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  CPU cost and allocations of the driver hot paths : response parsing, string trimming,
+//  command formatting and the sendCommand / readResponse exchange.
+//  The port is an in-memory SerXInterface whose replies come from the simulated wheel and
+//  reach the receive buffer following a byte arrival pattern. The driver runs on a virtual
+//  clock, so the waits in readResponse cost no wall time and only the CPU work is measured.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#define BENCH_COUNT_ALLOCATIONS
+#include "IndigoBench.h"
+
+#include "../PegasusIndigo.h"
+
+#define BENCH_ITERATIONS    20000
+
+#define ARRIVAL_BYTE_MS     1       // 9600 8N1 is ~1.04 ms per byte
+#define ARRIVAL_USB_MS      16      // default FTDI latency timer
+
+enum ArrivalPatterns {ARRIVAL_INSTANT = 0, ARRIVAL_BYTE_RATE, ARRIVAL_USB_LATENCY};
+
+// host serial port stand in, answered by the simulator
+class CMemorySerX : public SerXInterface
+{
+public:
+    CMemorySerX(CIndigoClock *pClock) : m_pClock(pClock)
+    {
+        m_nPattern = ARRIVAL_INSTANT;
+        m_bOpen = false;
+        m_Sim.setClock(pClock);
+        m_Sim.setReplyDelay(0);
+        m_Sim.open("sim");
+    };
+
+    void setPattern(int nPattern) { m_nPattern = nPattern; };
+
+    // queue bytes as if the device had sent them
+    void inject(const char *pData, size_t nLength)
+    {
+        long long llNow = m_pClock->nowMs();
+
+        for(size_t i = 0; i < nLength; i++) {
+            switch(m_nPattern) {
+                case ARRIVAL_BYTE_RATE:
+                    m_vArrivals.push_back(llNow + (long long)(i + 1) * ARRIVAL_BYTE_MS);
+                    break;
+                case ARRIVAL_USB_LATENCY:
+                    m_vArrivals.push_back(llNow + ARRIVAL_USB_MS);
+                    break;
+                default:
+                    m_vArrivals.push_back(llNow);
+                    break;
+            }
+        }
+        m_sRx.append(pData, nLength);
+    };
+
+    virtual int open(const char * /*pszPort*/, const unsigned long & /*dwBaudRate*/ = 9600, const Parity & /*parity*/ = B_NOPARITY, const char * /*pszSession*/ = 0) { m_bOpen = true; return 0; };
+    virtual int close() { m_bOpen = false; return 0; };
+    virtual bool isConnected(void) const { return m_bOpen; };
+    virtual int flushTx(void) { return 0; };
+    virtual int purgeTxRx(void) { m_sRx.clear(); m_vArrivals.clear(); return 0; };
+    virtual int waitForBytesRx(const int & /*nNumber*/, const int & /*nTimeOutMilli*/) { return 0; };
+
+    virtual int readFile(void *lpBuffer, const unsigned long dwTotalToRead, unsigned long &dwTotalRead, const unsigned long & /*nTimeOutMilli*/)
+    {
+        int nAvailable = available();
+
+        dwTotalRead = std::min((unsigned long)nAvailable, dwTotalToRead);
+        memcpy(lpBuffer, m_sRx.data(), dwTotalRead);
+        m_sRx.erase(0, dwTotalRead);
+        m_vArrivals.erase(m_vArrivals.begin(), m_vArrivals.begin() + dwTotalRead);
+        return 0;
+    };
+
+    virtual int writeFile(void *lpBuffer, const unsigned long &dwBytesToWrite, unsigned long &pdwBytesWritten)
+    {
+        char szReply[256];
+        unsigned long ulRead;
+        int nWaiting;
+
+        m_Sim.writeFile(lpBuffer, dwBytesToWrite, pdwBytesWritten);
+        m_Sim.bytesWaitingRx(nWaiting);
+        if(nWaiting) {
+            m_Sim.readFile(szReply, std::min<int>(nWaiting, sizeof(szReply)), ulRead, 0);
+            inject(szReply, ulRead);
+        }
+        return 0;
+    };
+
+    virtual int bytesWaitingRx(int &nBytesWaitingRx) { nBytesWaitingRx = available(); return 0; };
+
+protected:
+    CIndigoClock            *m_pClock;
+    CIndigoSimPort          m_Sim;
+    int                     m_nPattern;
+    bool                    m_bOpen;
+    std::string             m_sRx;
+    std::vector<long long>  m_vArrivals;    // arrival time of each byte of m_sRx
+
+    int available()
+    {
+        long long llNow = m_pClock->nowMs();
+        int nCount = 0;
+
+        while(nCount < int(m_vArrivals.size()) && m_vArrivals[nCount] <= llNow)
+            nCount++;
+        return nCount;
+    };
+};
+
+// exposes the protected helpers
+class CBenchIndigo : public CPegasusIndigo
+{
+public:
+    using CPegasusIndigo::parseFields;
+    using CPegasusIndigo::trim;
+    using CPegasusIndigo::rtrim;
+    using CPegasusIndigo::moveCommand;
+};
+
+static const char *ArrivalNames[] = {"instant", "9600_baud", "usb_latency_16ms"};
+
+static void benchParsing(CIndigoBench &Bench)
+{
+    CBenchIndigo Indigo;
+    std::vector<std::string> vFields;
+    std::string sLine;
+
+    Bench.run("BM_parseFields/WF_reply", BENCH_ITERATIONS, [&] { Indigo.parseFields("WF:3", vFields, ':'); });
+    Bench.run("BM_parseFields/WV_reply", BENCH_ITERATIONS, [&] { Indigo.parseFields("WV:1.2.3", vFields, ':'); });
+    Bench.run("BM_parseFields/WR_WF_lines", BENCH_ITERATIONS, [&] { Indigo.parseFields("WR:0\nWF:3\n", vFields, '\n'); });
+
+    Bench.run("BM_rtrim/crlf", BENCH_ITERATIONS, [&] { sLine = "WF:3\r\n"; Indigo.rtrim(sLine, "\n\r"); });
+    Bench.run("BM_trim/spaces_crlf", BENCH_ITERATIONS, [&] { sLine = "  WF:3 \r\n"; Indigo.trim(sLine, " \n\r"); });
+
+    Bench.run("BM_moveCommand/format", BENCH_ITERATIONS, [&] { sLine = Indigo.moveCommand(5); });
+}
+
+static void benchExchange(CIndigoBench &Bench, int nPattern)
+{
+    CVirtualClock Clock;
+    CMemorySerX SerX(&Clock);
+    CBenchIndigo Indigo;
+    IndigoStatusSnapshot Snapshot;
+    std::string sName = ArrivalNames[nPattern];
+    std::string sResp;
+    int nSlot = 1;
+
+    Indigo.setClock(&Clock);
+    Indigo.SetSerxPointer(&SerX);
+    Indigo.setTransport(TRANSPORT_SERX);
+    // nothing else may talk to the port while we measure
+    Indigo.setHeartbeatInterval(0);
+    if(Indigo.Connect("mem")) {
+        fprintf(stderr, "%s : can't connect to the memory port\n", sName.c_str());
+        return;
+    }
+    SerX.setPattern(nPattern);
+
+    Bench.run("BM_readResponse/" + sName, BENCH_ITERATIONS, [&] { SerX.inject("WF:3\n", 5); Indigo.readResponse(sResp); });
+    Bench.run("BM_sendCommand/WF/" + sName, BENCH_ITERATIONS, [&] { Indigo.sendCommand("WF\n", sResp); });
+    // moveToFilterIndex minus the move monitor, whose polling would run concurrently with the benchmark
+    Bench.run("BM_sendCommand/WM/" + sName, BENCH_ITERATIONS, [&] { nSlot = nSlot % SIM_NB_SLOTS + 1; Indigo.sendCommand(Indigo.moveCommand(nSlot), sResp, MAX_TIMEOUT, PRIORITY_MOTION); });
+    // one poll of the host, WR and WF in one exchange
+    Bench.run("BM_statusPoll/" + sName, BENCH_ITERATIONS, [&] { Indigo.getStatusSnapshot(Snapshot, 0); Clock.advanceMs(1); });
+
+    Indigo.Disconnect();
+}
+
+int main(int argc, char **argv)
+{
+    CIndigoBench Bench(argc, argv);
+
+    benchParsing(Bench);
+    benchExchange(Bench, ARRIVAL_INSTANT);
+    benchExchange(Bench, ARRIVAL_BYTE_RATE);
+    benchExchange(Bench, ARRIVAL_USB_LATENCY);
+
+    return Bench.report();
+}
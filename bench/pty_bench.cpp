@@ -0,0 +1,137 @@
+//
+//  pty_bench.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Round trip latency of the native termios transport against the SerX polling model,
+//  on a pseudo terminal answered by the simulated wheel.
+//  The SerX path is modelled by the same tty with canWaitRx() disabled, so readResponse
+//  goes through bytesWaitingRx() and MAX_READ_WAIT_TIMEOUT sleeps exactly as it does with the host port.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include <stdlib.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+
+#include <atomic>
+#include <thread>
+
+#include "../PegasusIndigo.h"
+#include "IndigoBench.h"
+
+#define BENCH_ROUND_TRIPS   200
+
+// the SerX polling model on the same tty
+class CPollingTermiosPort : public CIndigoTermiosPort
+{
+public:
+    virtual bool    canWaitRx() { return false; };
+};
+
+// the Indigo firmware on the master side of the pty, replies come from the simulator
+class CPtyEmulator
+{
+public:
+    CPtyEmulator() { m_nMaster = -1; m_bRun = false; };
+    ~CPtyEmulator() { stop(); };
+
+    const char *start()
+    {
+        struct termios tty;
+
+        m_nMaster = posix_openpt(O_RDWR | O_NOCTTY);
+        if(m_nMaster < 0 || grantpt(m_nMaster) || unlockpt(m_nMaster))
+            return NULL;
+        // no echo or line processing on the emulator side
+        tcgetattr(m_nMaster, &tty);
+        cfmakeraw(&tty);
+        tcsetattr(m_nMaster, TCSANOW, &tty);
+        m_SimPort.setReplyDelay(0);
+        m_SimPort.open("pty");
+        m_bRun = true;
+        m_Thread = std::thread(&CPtyEmulator::run, this);
+        return ptsname(m_nMaster);
+    };
+
+    void stop()
+    {
+        m_bRun = false;
+        if(m_Thread.joinable())
+            m_Thread.join();
+        if(m_nMaster >= 0)
+            close(m_nMaster);
+        m_nMaster = -1;
+    };
+
+protected:
+    int                 m_nMaster;
+    std::atomic<bool>   m_bRun;
+    std::thread         m_Thread;
+    CIndigoSimPort      m_SimPort;
+
+    void run()
+    {
+        struct pollfd Pfd;
+        char szBuf[256];
+        ssize_t nRead;
+        unsigned long ulBytes;
+        int nWaiting;
+
+        Pfd.fd = m_nMaster;
+        Pfd.events = POLLIN;
+        while(m_bRun) {
+            if(poll(&Pfd, 1, 50) <= 0)
+                continue;
+            nRead = read(m_nMaster, szBuf, sizeof(szBuf));
+            if(nRead <= 0)
+                continue;
+            m_SimPort.writeFile(szBuf, nRead, ulBytes);
+            m_SimPort.bytesWaitingRx(nWaiting);
+            if(nWaiting) {
+                m_SimPort.readFile(szBuf, std::min<int>(nWaiting, sizeof(szBuf)), ulBytes, 0);
+                if(write(m_nMaster, szBuf, ulBytes) < 0)
+                    break;
+            }
+        }
+    };
+};
+
+static void benchPort(CIndigoBench &Bench, const std::string &sName, CIndigoPort *pPort, const char *szPty)
+{
+    CPegasusIndigo Indigo;
+    IndigoStatusSnapshot Snapshot;
+    int nSlot;
+
+    Indigo.setPort(pPort);
+    if(Indigo.Connect(szPty)) {
+        fprintf(stderr, "%s : can't connect to %s\n", sName.c_str(), szPty);
+        return;
+    }
+    Bench.run(sName + "/WF_round_trip", BENCH_ROUND_TRIPS, [&] { Indigo.getCurrentSlot(nSlot); });
+    // a negative max age never serves the cache, every iteration is a WR+WF exchange
+    Bench.run(sName + "/WR_WF_pipelined", BENCH_ROUND_TRIPS, [&] { Indigo.getStatusSnapshot(Snapshot, -1); });
+    Indigo.Disconnect();
+}
+
+int main(int argc, char **argv)
+{
+    CIndigoBench Bench(argc, argv);
+    CPtyEmulator Emulator;
+    CIndigoTermiosPort TermiosPort;
+    CPollingTermiosPort PollingPort;
+    const char *szPty;
+
+    szPty = Emulator.start();
+    if(!szPty) {
+        fprintf(stderr, "can't create a pseudo terminal\n");
+        return 1;
+    }
+
+    benchPort(Bench, "BM_SerXPolling", &PollingPort, szPty);
+    benchPort(Bench, "BM_Termios", &TermiosPort, szPty);
+
+    Emulator.stop();
+    return Bench.report();
+}
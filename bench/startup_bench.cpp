@@ -0,0 +1,229 @@
+//
+//  startup_bench.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  What the plugin costs the host : loading it and building an instance (the host does this for
+//  every installed plugin when it starts, used or not), and going from establishLink to the end
+//  of the first move.
+//  The plugin is loaded with dlopen like the host does, --plugin=<path> (default ../libPegasusIndigo.so).
+//  The host interfaces are stubs, the ini selects the simulated wheel and the host clock is
+//  virtual (sleeping advances the tick count), so the move measures the driver and not the
+//  simulated mechanics. host_ms is how long the move took on that clock.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoBench.h"
+
+#include <dlfcn.h>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#include "../main.h"
+
+#define STARTUP_ITERATIONS  200
+#define MOVE_ITERATIONS     50
+#define HOST_POLL_INTERVAL  100     // ms, between two isCompleteFilterWheelMoveTo
+
+typedef decltype(&sbPlugInFactory2) PlugInFactoryProc;
+
+static std::atomic<long long> g_llVirtualMs(0);
+
+class CBenchIni : public BasicIniUtilInterface
+{
+public:
+    CBenchIni()
+    {
+        m_mValues[CHILD_KEY_TRANSPORT] = std::to_string(TRANSPORT_SIMULATOR);
+        // the virtual clock jumps, keep the heartbeat out of the measurement
+        m_mValues[CHILD_KEY_HEARTBEAT] = "0";
+    };
+
+    virtual int readString(const char * /*pszParentKey*/, const char *pszChildKey, const char *pszDefault, char *pszReturnValue, int nMaxSizeOfReturnValue)
+    {
+        std::map<std::string, std::string>::iterator it = m_mValues.find(pszChildKey);
+        snprintf(pszReturnValue, nMaxSizeOfReturnValue, "%s", it == m_mValues.end() ? pszDefault : it->second.c_str());
+        return 0;
+    };
+    virtual int writeString(const char * /*pszParentKey*/, const char *pszChildKey, const char *pszValue) { m_mValues[pszChildKey] = pszValue; return 0; };
+    virtual int readInt(const char * /*pszParentKey*/, const char *pszChildKey, const int &nDefault)
+    {
+        std::map<std::string, std::string>::iterator it = m_mValues.find(pszChildKey);
+        return it == m_mValues.end() ? nDefault : atoi(it->second.c_str());
+    };
+    virtual int writeInt(const char * /*pszParentKey*/, const char *pszChildKey, const int &nValue) { m_mValues[pszChildKey] = std::to_string(nValue); return 0; };
+    virtual double readDouble(const char * /*pszParentKey*/, const char *pszChildKey, const double &dDefault)
+    {
+        std::map<std::string, std::string>::iterator it = m_mValues.find(pszChildKey);
+        return it == m_mValues.end() ? dDefault : atof(it->second.c_str());
+    };
+    virtual int writeDouble(const char * /*pszParentKey*/, const char *pszChildKey, const double &dValue) { m_mValues[pszChildKey] = std::to_string(dValue); return 0; };
+
+protected:
+    std::map<std::string, std::string> m_mValues;
+};
+
+class CBenchMutex : public MutexInterface
+{
+public:
+    virtual void lock() { m_Mutex.lock(); };
+    virtual void unlock() { m_Mutex.unlock(); };
+
+protected:
+    std::recursive_mutex m_Mutex;
+};
+
+class CBenchSleeper : public SleeperInterface
+{
+public:
+    virtual void sleep(const int &milliSecondsToSleep) { g_llVirtualMs += milliSecondsToSleep; std::this_thread::yield(); };
+};
+
+class CBenchTickCount : public TickCountInterface
+{
+public:
+    virtual int elapsed() { return int(g_llVirtualMs); };
+};
+
+static long long elapsedNs(std::chrono::steady_clock::time_point tStart)
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - tStart).count();
+}
+
+// the plugin owns and deletes the interfaces it is given, like the host expects
+static FilterWheelDriverInterface *createWheel(PlugInFactoryProc pFactory, CBenchSleeper **ppSleeper)
+{
+    void *pObject = NULL;
+    CBenchSleeper *pSleeper = new CBenchSleeper;
+
+    pFactory("Pegasus Astro Indigo", 0, NULL, NULL, pSleeper, new CBenchIni, NULL, new CBenchMutex, new CBenchTickCount, &pObject);
+    if(ppSleeper)
+        *ppSleeper = pSleeper;
+    return static_cast<X2FilterWheel *>(pObject);
+}
+
+// RTLD_NOLOAD tells if dlclose really unloaded it, otherwise only the first load is cold
+static bool isUnloaded(const std::string &sPlugin)
+{
+    void *pPlugin = dlopen(sPlugin.c_str(), RTLD_NOW | RTLD_NOLOAD);
+
+    if(!pPlugin)
+        return true;
+    dlclose(pPlugin);
+    return false;
+}
+
+static long long loadToFactory(const std::string &sPlugin)
+{
+    FilterWheelDriverInterface *pWheel;
+    PlugInFactoryProc pFactory;
+    std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+    void *pPlugin;
+    long long llNs;
+
+    pPlugin = dlopen(sPlugin.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!pPlugin)
+        return 0LL;
+    pFactory = (PlugInFactoryProc)dlsym(pPlugin, "sbPlugInFactory2");
+    pWheel = createWheel(pFactory, NULL);
+    llNs = elapsedNs(tStart);
+
+    delete pWheel;
+    dlclose(pPlugin);
+    return llNs;
+}
+
+// false when the plugin can't be unloaded (a STB_GNU_UNIQUE symbol does that), there is no cold load to measure
+static bool benchLoad(CIndigoBench &Bench, const std::string &sPlugin)
+{
+    bool bStayed = false;
+
+    loadToFactory(sPlugin);
+    if(!isUnloaded(sPlugin)) {
+        fprintf(stderr, "%s stays loaded after dlclose, the cold load can't be measured\n", sPlugin.c_str());
+        return false;
+    }
+
+    Bench.runManual("BM_startup/dlopen_to_factory", STARTUP_ITERATIONS, [&] {
+        long long llNs = loadToFactory(sPlugin);
+
+        if(!isUnloaded(sPlugin))
+            bStayed = true;
+        return llNs;
+    });
+    if(bStayed) {
+        fprintf(stderr, "%s stayed loaded after a dlclose, BM_startup/dlopen_to_factory isn't a cold load\n", sPlugin.c_str());
+        return false;
+    }
+    return true;
+}
+
+static void benchFirstMove(CIndigoBench &Bench, PlugInFactoryProc pFactory)
+{
+    BenchResult *pResult;
+    long long llHostMs = 0;
+
+    Bench.runManual("BM_startup/factory", STARTUP_ITERATIONS, [&] {
+        std::chrono::steady_clock::time_point tStart = std::chrono::steady_clock::now();
+        FilterWheelDriverInterface *pWheel = createWheel(pFactory, NULL);
+        long long llNs = elapsedNs(tStart);
+
+        delete pWheel;
+        return llNs;
+    });
+
+    pResult = Bench.runManual("BM_startup/link_to_first_move", MOVE_ITERATIONS, [&] {
+        CBenchSleeper *pSleeper;
+        FilterWheelDriverInterface *pWheel = createWheel(pFactory, &pSleeper);
+        std::chrono::steady_clock::time_point tStart;
+        long long llNs;
+        long long llStartMs;
+        bool bComplete = false;
+
+        tStart = std::chrono::steady_clock::now();
+        llStartMs = g_llVirtualMs;
+        if(pWheel->establishLink() == 0 && pWheel->startFilterWheelMoveTo(1) == 0) {
+            while(pWheel->isCompleteFilterWheelMoveTo(bComplete) == 0 && !bComplete)
+                pSleeper->sleep(HOST_POLL_INTERVAL);
+        }
+        llNs = elapsedNs(tStart);
+        llHostMs += g_llVirtualMs - llStartMs;
+        if(!bComplete)
+            fprintf(stderr, "BM_startup/link_to_first_move : the move didn't complete\n");
+
+        pWheel->terminateLink();
+        delete pWheel;
+        return llNs;
+    });
+    if(pResult)
+        pResult->mCounters["host_ms"] = double(llHostMs) / MOVE_ITERATIONS;
+}
+
+int main(int argc, char **argv)
+{
+    CIndigoBench Bench(argc, argv);
+    std::string sPlugin = "../libPegasusIndigo.so";
+    void *pPlugin;
+
+    for(int i = 1; i < argc; i++) {
+        if(!strncmp(argv[i], "--plugin=", 9))
+            sPlugin = argv[i] + 9;
+    }
+
+    pPlugin = dlopen(sPlugin.c_str(), RTLD_NOW | RTLD_LOCAL);
+    if(!pPlugin) {
+        fprintf(stderr, "can't load %s : %s\n", sPlugin.c_str(), dlerror());
+        return 1;
+    }
+    dlclose(pPlugin);
+
+    if(!benchLoad(Bench, sPlugin))
+        return 1;
+
+    pPlugin = dlopen(sPlugin.c_str(), RTLD_NOW | RTLD_LOCAL);
+    benchFirstMove(Bench, (PlugInFactoryProc)dlsym(pPlugin, "sbPlugInFactory2"));
+    dlclose(pPlugin);
+
+    return Bench.report();
+}
@@ -0,0 +1,266 @@
+//
+//  IndigoBroker.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoBroker.h"
+
+CIndigoBroker::CIndigoBroker()
+{
+    m_nListenFd = -1;
+    m_nNextClient = 0;
+    m_bStop = false;
+    m_bVerbose = false;
+}
+
+CIndigoBroker::~CIndigoBroker()
+{
+    close();
+}
+
+int CIndigoBroker::open(const char *szPort)
+{
+    struct sockaddr_un Addr;
+    int nErr;
+    mode_t nOldMask;
+
+    close();
+    m_sPort.assign(szPort);
+    m_sSocketPath = CIndigoBrokerPort::socketPath(szPort, true);
+    if(m_sSocketPath.empty() || m_sSocketPath.size() >= sizeof(Addr.sun_path))
+        return ERR_COMMNOLINK;
+
+    nErr = m_Port.open(szPort);
+    if(nErr)
+        return nErr;
+
+    memset(&Addr, 0, sizeof(Addr));
+    Addr.sun_family = AF_UNIX;
+    strncpy(Addr.sun_path, m_sSocketPath.c_str(), sizeof(Addr.sun_path) - 1);
+
+    m_nListenFd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if(m_nListenFd < 0) {
+        close();
+        return ERR_COMMNOLINK;
+    }
+    // the tty is ours (TIOCEXCL), so a socket left there is from a broker that died
+    unlink(m_sSocketPath.c_str());
+    // the socket is created owner only, it is never reachable with looser permissions
+    nOldMask = umask(0177);
+    nErr = bind(m_nListenFd, (struct sockaddr *)&Addr, sizeof(Addr));
+    umask(nOldMask);
+    if(nErr != 0 || listen(m_nListenFd, 8) != 0) {
+        close();
+        return ERR_COMMNOLINK;
+    }
+    return 0;
+}
+
+void CIndigoBroker::close()
+{
+    for(IndigoBrokerClient &Client : m_Clients)
+        ::close(Client.nFd);
+    m_Clients.clear();
+    m_nNextClient = 0;
+
+    if(m_nListenFd >= 0) {
+        ::close(m_nListenFd);
+        unlink(m_sSocketPath.c_str());
+    }
+    m_nListenFd = -1;
+    m_Port.close();
+}
+
+int CIndigoBroker::run()
+{
+    std::vector<struct pollfd> vPfds;
+    struct pollfd Pfd;
+    bool bPending;
+    int nRet;
+    size_t i;
+
+    if(m_nListenFd < 0)
+        return ERR_COMMNOLINK;
+
+    while(!m_bStop) {
+        vPfds.clear();
+        Pfd.fd = m_nListenFd;
+        Pfd.events = POLLIN;
+        Pfd.revents = 0;
+        vPfds.push_back(Pfd);
+
+        bPending = false;
+        for(IndigoBrokerClient &Client : m_Clients) {
+            Pfd.fd = Client.nFd;
+            // a client with a full queue waits, its requests stay in the socket buffer
+            Pfd.events = Client.Queue.size() < BROKER_MAX_QUEUE ? POLLIN : 0;
+            vPfds.push_back(Pfd);
+            if(!Client.Queue.empty())
+                bPending = true;
+        }
+
+        nRet = poll(vPfds.data(), vPfds.size(), bPending ? 0 : BROKER_POLL_TIMEOUT);
+        if(nRet < 0 && errno != EINTR)
+            return ERR_COMMNOLINK;
+
+        if(nRet > 0) {
+            // clients first, accepting may grow m_Clients
+            for(i = m_Clients.size(); i > 0; i--) {
+                if(!vPfds[i].revents)
+                    continue;
+                if(!readClient(m_Clients[i - 1])) {
+                    if(m_bVerbose)
+                        fprintf(stderr, "client %d disconnected\n", m_Clients[i - 1].nFd);
+                    ::close(m_Clients[i - 1].nFd);
+                    m_Clients.erase(m_Clients.begin() + (i - 1));
+                    if(m_nNextClient >= i)
+                        m_nNextClient--;
+                }
+            }
+            if(vPfds[0].revents & POLLIN)
+                acceptClient();
+        }
+
+        serveNext();
+    }
+    return 0;
+}
+
+void CIndigoBroker::acceptClient()
+{
+    IndigoBrokerClient Client;
+
+    Client.nFd = accept4(m_nListenFd, NULL, NULL, SOCK_CLOEXEC);
+    if(Client.nFd < 0)
+        return;
+    if(m_bVerbose)
+        fprintf(stderr, "client %d connected\n", Client.nFd);
+    m_Clients.push_back(Client);
+}
+
+bool CIndigoBroker::readClient(IndigoBrokerClient &Client)
+{
+    IndigoBrokerRequest Request;
+    char szBuffer[BROKER_MAX_PAYLOAD];
+    ssize_t nRead;
+
+    nRead = recv(Client.nFd, szBuffer, sizeof(szBuffer), MSG_DONTWAIT);
+    if(nRead < 0)
+        return errno == EINTR || errno == EAGAIN || errno == EWOULDBLOCK;
+    if(nRead == 0)
+        return false;
+    Client.sFrameBuffer.append(szBuffer, nRead);
+
+    while(Client.sFrameBuffer.size() >= sizeof(IndigoBrokerFrame)) {
+        memcpy(&Request.Header, Client.sFrameBuffer.data(), sizeof(IndigoBrokerFrame));
+        if(Request.Header.nLength > BROKER_MAX_PAYLOAD)
+            return false;   // not speaking our protocol
+        if(Client.sFrameBuffer.size() < sizeof(IndigoBrokerFrame) + Request.Header.nLength)
+            break;
+        Request.sPayload.assign(Client.sFrameBuffer, sizeof(IndigoBrokerFrame), Request.Header.nLength);
+        Client.sFrameBuffer.erase(0, sizeof(IndigoBrokerFrame) + Request.Header.nLength);
+        Client.Queue.push_back(Request);
+    }
+    return true;
+}
+
+void CIndigoBroker::serveNext()
+{
+    IndigoBrokerRequest Request;
+    std::string sReply;
+    size_t nClients = m_Clients.size();
+    size_t nIndex;
+    int nLines;
+
+    // next client after the one served last that has something queued
+    for(size_t i = 0; i < nClients; i++) {
+        nIndex = (m_nNextClient + i) % nClients;
+        if(m_Clients[nIndex].Queue.empty())
+            continue;
+
+        Request = m_Clients[nIndex].Queue.front();
+        m_Clients[nIndex].Queue.pop_front();
+        transact(Request, sReply, nLines);
+        // a client that went away is dropped on the next poll
+        sendReply(m_Clients[nIndex], Request.Header.nSeq, sReply, nLines);
+        m_nNextClient = (nIndex + 1) % nClients;
+        return;
+    }
+}
+
+void CIndigoBroker::transact(const IndigoBrokerRequest &Request, std::string &sReply, int &nLines)
+{
+    char szBuffer[BROKER_MAX_PAYLOAD];
+    unsigned long ulBytesWritten;
+    unsigned long ulBytesRead;
+    long long llDeadline;
+    int nBytesWaiting;
+    int nErr;
+
+    sReply.clear();
+    nLines = 0;
+
+    // the tty was unplugged at some point, try to get it back before giving up on this request
+    if(!m_Port.isOpen() && m_Port.open(m_sPort.c_str()))
+        return;
+
+    // whatever is left belongs to a request that timed out, possibly from another client
+    m_Port.purgeTxRx();
+    nErr = m_Port.writeFile((void *)Request.sPayload.data(), Request.sPayload.size(), ulBytesWritten);
+    if(!nErr)
+        nErr = m_Port.flushTx();
+    if(nErr) {
+        m_Port.close();
+        return;
+    }
+
+    llDeadline = m_Clock.nowMs() + BROKER_REPLY_TIMEOUT;
+    while(nLines < Request.Header.nLines && m_Clock.nowMs() < llDeadline) {
+        nErr = m_Port.waitRx(int(llDeadline - m_Clock.nowMs()));
+        if(!nErr)
+            nErr = m_Port.bytesWaitingRx(nBytesWaiting);
+        if(nErr) {
+            m_Port.close();
+            break;
+        }
+        if(!nBytesWaiting)
+            continue;
+        nErr = m_Port.readFile(szBuffer, std::min(nBytesWaiting, BROKER_MAX_PAYLOAD), ulBytesRead, 0);
+        if(nErr) {
+            m_Port.close();
+            break;
+        }
+        sReply.append(szBuffer, ulBytesRead);
+        nLines = int(std::count(sReply.begin(), sReply.end(), '\n'));
+    }
+
+    if(m_bVerbose)
+        fprintf(stderr, "%zu bytes, %d/%d lines\n", Request.sPayload.size(), nLines, Request.Header.nLines);
+}
+
+bool CIndigoBroker::sendReply(IndigoBrokerClient &Client, uint32_t nSeq, const std::string &sReply, int nLines)
+{
+    IndigoBrokerFrame Frame;
+    std::string sFrame;
+    size_t nSent = 0;
+    ssize_t nRet;
+
+    Frame.nSeq = nSeq;
+    Frame.nLines = (uint16_t)nLines;
+    Frame.nLength = (uint16_t)std::min(sReply.size(), (size_t)BROKER_MAX_PAYLOAD);
+    sFrame.assign((const char *)&Frame, sizeof(Frame));
+    sFrame.append(sReply, 0, Frame.nLength);
+
+    while(nSent < sFrame.size()) {
+        nRet = send(Client.nFd, sFrame.data() + nSent, sFrame.size() - nSent, MSG_NOSIGNAL);
+        if(nRet < 0) {
+            if(errno == EINTR)
+                continue;
+            return false;
+        }
+        nSent += nRet;
+    }
+    return true;
+}
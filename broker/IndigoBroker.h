@@ -0,0 +1,76 @@
+//
+//  IndigoBroker.h
+//  Pegasus Indigo Filter Wheel
+//
+//  Serial broker : owns one tty and serves requests from several local drivers (wheel, UPB, PPB, ...)
+//  over a Unix socket, so they can share a USB chain without fighting for the port.
+//  Each client has its own request queue and the queues are served round robin, one request per
+//  turn, so a chatty client can't starve the others. Protocol is in IndigoPort.h (IndigoBrokerFrame).
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#ifndef IndigoBroker_h
+#define IndigoBroker_h
+
+#include <signal.h>
+#include <sys/stat.h>
+
+// C++ includes
+#include <string>
+#include <vector>
+#include <deque>
+#include <atomic>
+
+#include "../IndigoPort.h"
+#include "../IndigoClock.h"
+
+#define BROKER_MAX_QUEUE        16      // pending requests per client before we stop reading its socket
+#define BROKER_POLL_TIMEOUT     500     // ms, idle wait so stop() is noticed
+
+typedef struct {
+    IndigoBrokerFrame   Header;
+    std::string         sPayload;
+} IndigoBrokerRequest;
+
+typedef struct {
+    int                             nFd;
+    std::string                     sFrameBuffer;
+    std::deque<IndigoBrokerRequest> Queue;
+} IndigoBrokerClient;
+
+class CIndigoBroker
+{
+public:
+    CIndigoBroker();
+    ~CIndigoBroker();
+
+    int             open(const char *szPort);
+    void            close();
+    const std::string &getSocketPath() { return m_sSocketPath; };
+
+    // serve until stop() is called
+    int             run();
+    void            stop() { m_bStop = true; };
+
+    void            setVerbose(bool bVerbose) { m_bVerbose = bVerbose; };
+
+protected:
+    CIndigoTermiosPort              m_Port;
+    CSteadyClock                    m_Clock;
+    std::string                     m_sPort;
+    std::string                     m_sSocketPath;
+    int                             m_nListenFd;
+    std::vector<IndigoBrokerClient> m_Clients;
+    size_t                          m_nNextClient;
+    std::atomic<bool>               m_bStop;
+    bool                            m_bVerbose;
+
+    void            acceptClient();
+    bool            readClient(IndigoBrokerClient &Client);
+    void            serveNext();
+    void            transact(const IndigoBrokerRequest &Request, std::string &sReply, int &nLines);
+    bool            sendReply(IndigoBrokerClient &Client, uint32_t nSeq, const std::string &sReply, int nLines);
+};
+
+#endif /* IndigoBroker_h */
@@ -0,0 +1,56 @@
+//
+//  indigo_broker.cpp
+//  Pegasus Indigo Filter Wheel
+//
+//  indigo_broker [-v] <tty>
+//  Drivers select it with Transport=3 and the same port name as the broker.
+//  Run it as the user running TheSkyX, the socket is in that user's private runtime directory.
+//
+//  Copyright © 2022 RTI-Zone. All rights reserved.
+//
+
+#include "IndigoBroker.h"
+
+static CIndigoBroker *g_pBroker = NULL;
+
+static void onSignal(int /*nSignal*/)
+{
+    if(g_pBroker)
+        g_pBroker->stop();
+}
+
+int main(int argc, char **argv)
+{
+    CIndigoBroker Broker;
+    struct sigaction Action;
+    const char *szPort = NULL;
+    int nErr;
+
+    for(int i = 1; i < argc; i++) {
+        if(strcmp(argv[i], "-v") == 0)
+            Broker.setVerbose(true);
+        else
+            szPort = argv[i];
+    }
+    if(!szPort) {
+        fprintf(stderr, "usage : %s [-v] <tty>\n", argv[0]);
+        return 1;
+    }
+
+    nErr = Broker.open(szPort);
+    if(nErr) {
+        fprintf(stderr, "can't open %s : %s\n", szPort, strerror(errno));
+        return 1;
+    }
+    fprintf(stderr, "serving %s on %s\n", szPort, Broker.getSocketPath().c_str());
+
+    g_pBroker = &Broker;
+    memset(&Action, 0, sizeof(Action));
+    Action.sa_handler = onSignal;
+    sigaction(SIGINT, &Action, NULL);
+    sigaction(SIGTERM, &Action, NULL);
+
+    nErr = Broker.run();
+    Broker.close();
+    return nErr ? 1 : 0;
+}
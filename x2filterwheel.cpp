@@ -13,33 +13,64 @@ X2FilterWheel::X2FilterWheel(const char* pszDriverSelection,
 {
 	m_nPrivateMulitInstanceIndex	= nInstanceIndex;
 	m_pSerX							= pSerX;		
+	m_pTheSkyXForMounts				= pTheSkyX;
+	m_pSleeper						= pSleeper;
 	m_pIniUtil						= pIniUtil;
+	m_pLogger						= pLogger;
 	m_pIOMutex						= pIOMutex;
+	m_pTickCount					= pTickCount;
 
     m_bLinked = false;
+    m_bTracing = false;
+    m_nSavedFilterCount = 0;
     m_PegasusIndigo.SetSerxPointer(pSerX);
-
+    // all waits and timestamps in the driver go through the host sleeper and tick count
+    m_HostClock.setInterfaces(pSleeper, pTickCount);
+    m_PegasusIndigo.setClock(&m_HostClock);
+    // no ini access here, the host builds every installed plugin at startup even if it's never used.
+    // The filter table is read on first use, the rest on establishLink.
 }
 
 X2FilterWheel::~X2FilterWheel()
 {
+    CIndigoGroup::instance().unregisterWheel(m_nPrivateMulitInstanceIndex, &m_PegasusIndigo);
+    // the driver and its threads must be done with the host interfaces before they go
+    m_PegasusIndigo.Disconnect();
+    m_PegasusIndigo.releaseParkedPort();
+    m_HostClock.setInterfaces(NULL, NULL);
+    releaseTrace();
 	if (m_pSerX)
 		delete m_pSerX;
+	if (m_pTheSkyXForMounts)
+		delete m_pTheSkyXForMounts;
 	if (m_pIniUtil)
 		delete m_pIniUtil;
+	if (m_pLogger)
+		delete m_pLogger;
 	if (m_pIOMutex)
 		delete m_pIOMutex;
+	if (m_pSleeper)
+		delete m_pSleeper;
+	if (m_pTickCount)
+		delete m_pTickCount;
 }
 
 
 int	X2FilterWheel::queryAbstraction(const char* pszName, void** ppVal)
 {
-	X2MutexLocker ml(GetMutex());
+    CIndigoTraceSpan Span("queryAbstraction", TRACE_CAT_X2, "name", pszName);
+	X2TracedMutexLocker ml(GetMutex());
 
 	*ppVal = NULL;
 
     if (!strcmp(pszName, SerialPortParams2Interface_Name))
         *ppVal = dynamic_cast<SerialPortParams2Interface*>(this);
+    else if (!strcmp(pszName, IndigoStatusInterface_Name))
+        *ppVal = dynamic_cast<IndigoStatusInterface*>(this);
+    else if (!strcmp(pszName, IndigoFilterInfoInterface_Name))
+        *ppVal = dynamic_cast<IndigoFilterInfoInterface*>(this);
+    else if (!strcmp(pszName, IndigoGroupInterface_Name))
+        *ppVal = dynamic_cast<IndigoGroupInterface*>(this);
 
     return SB_OK;
 }
@@ -51,31 +82,59 @@ int	X2FilterWheel::establishLink(void)
 {
     int nErr;
     char szPort[DRIVER_MAX_STRING];
-
-    X2MutexLocker ml(GetMutex());
+    char szTraceFile[DRIVER_MAX_STRING];
+
+    X2TracedMutexLocker ml(GetMutex());
+    if (m_pIniUtil && !m_bTracing) {
+        // the first instance to link with a trace file set starts the process wide trace,
+        // the last of them to unlink stops it
+        m_pIniUtil->readString(PARENT_KEY, CHILD_KEY_TRACE_FILE, "", szTraceFile, DRIVER_MAX_STRING);
+        m_bTracing = (CIndigoTrace::instance().start(szTraceFile) == 0);
+    }
+    CIndigoTraceSpan Span("establishLink", TRACE_CAT_X2);
+    ensureFilterTable();
     // get serial port device name
     portNameOnToCharPtr(szPort,DRIVER_MAX_STRING);
+    if (m_pIniUtil) {
+        m_PegasusIndigo.setTransport(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_TRANSPORT, TRANSPORT_SERX));
+        m_PegasusIndigo.setHeartbeatInterval(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_HEARTBEAT, HEARTBEAT_INTERVAL));
+        m_PegasusIndigo.setLinkGracePeriod(m_pIniUtil->readInt(PARENT_KEY, CHILD_KEY_LINK_GRACE, LINK_GRACE_PERIOD));
+    }
     nErr = m_PegasusIndigo.Connect(szPort);
-    if(nErr)
+    if(nErr) {
         m_bLinked = false;
-    else
+        Span.end();
+        releaseTrace();
+    }
+    else {
         m_bLinked = true;
+        loadFilterCount();
+        loadMoveTimes();
+        CIndigoGroup::instance().registerWheel(m_nPrivateMulitInstanceIndex, &m_PegasusIndigo);
+    }
 
     return nErr;
 }
 
 int	X2FilterWheel::terminateLink(void)
 {
-    X2MutexLocker ml(GetMutex());
+    CIndigoTraceSpan Span("terminateLink", TRACE_CAT_X2);
+    X2TracedMutexLocker ml(GetMutex());
+    // waits for a group move using this wheel
+    CIndigoGroup::instance().unregisterWheel(m_nPrivateMulitInstanceIndex, &m_PegasusIndigo);
+    saveMoveTimes();
+    saveFilterCount();
     m_PegasusIndigo.Disconnect();
     m_bLinked = false;
+    Span.end();
+    releaseTrace();
     return SB_OK;
 }
 
 bool X2FilterWheel::isLinked(void) const
 {
     X2FilterWheel* pMe = (X2FilterWheel*)this;
-    X2MutexLocker ml(pMe->GetMutex());
+    X2TracedMutexLocker ml(pMe->GetMutex());
     return pMe->m_bLinked;
 }
 
@@ -84,6 +143,14 @@ bool X2FilterWheel::isEstablishLinkAbortable(void) const	{
     return false;
 }
 
+void X2FilterWheel::releaseTrace()
+{
+    if(!m_bTracing)
+        return;
+    m_bTracing = false;
+    CIndigoTrace::instance().stop();
+}
+
 
 #pragma mark - AbstractDriverInfo
 
@@ -116,8 +183,10 @@ void X2FilterWheel::deviceInfoDetailedDescription(BasicStringInterface& str) con
 
 void X2FilterWheel::deviceInfoFirmwareVersion(BasicStringInterface& str)
 {
+    CIndigoTraceSpan Span("deviceInfoFirmwareVersion", TRACE_CAT_X2);
     if(m_bLinked) {
-        X2MutexLocker ml(GetMutex());
+        // port access is arbitrated by the driver command scheduler, not the host mutex,
+        // so this informational query can't delay a move.
         std::string sFirmware;
         m_PegasusIndigo.getFirmwareVersion(sFirmware);
         str = sFirmware.c_str();
@@ -128,7 +197,7 @@ void X2FilterWheel::deviceInfoFirmwareVersion(BasicStringInterface& str)
 void X2FilterWheel::deviceInfoModel(BasicStringInterface& str)				
 {
     if(m_bLinked) {
-        X2MutexLocker ml(GetMutex());
+        X2TracedMutexLocker ml(GetMutex());
         str = "Pegasus Astro Indigo Filter Wheel ";
     }
     else
@@ -140,7 +209,8 @@ void X2FilterWheel::deviceInfoModel(BasicStringInterface& str)
 int	X2FilterWheel::filterCount(int& nCount)
 {
     int nErr = SB_OK;
-    X2MutexLocker ml(GetMutex());
+    CIndigoTraceSpan Span("filterCount", TRACE_CAT_X2);
+    // cached in the driver, no need for the host mutex
     nErr = m_PegasusIndigo.getFilterCount(nCount);
     if(nErr) {
         nErr = ERR_CMDFAILED;
@@ -150,50 +220,18 @@ int	X2FilterWheel::filterCount(int& nCount)
 
 int	X2FilterWheel::defaultFilterName(const int& nIndex, BasicStringInterface& strFilterNameOut)
 {
-	X2MutexLocker ml(GetMutex());
-    switch(nIndex) {
-        case 0:
-            strFilterNameOut = "L";
-            break;
-
-        case 1:
-            strFilterNameOut = "R";
-            break;
-
-        case 2:
-            strFilterNameOut = "G";
-            break;
-
-        case 3:
-            strFilterNameOut = "B";
-            break;
-
-        case 4:
-            strFilterNameOut = "Ha";
-            break;
-
-        case 5:
-            strFilterNameOut = "O-III";
-            break;
-
-        case 6:
-            strFilterNameOut = "S-II";
-            break;
-
-        default:
-            strFilterNameOut = "Unknown";
-            break;
-
-    }
+    // read only once loaded
+    ensureFilterTable();
+    strFilterNameOut = m_PegasusIndigo.getFilterTable().getName(nIndex + 1);
     return SB_OK;
 }
 
 int	X2FilterWheel::startFilterWheelMoveTo(const int& nTargetPosition)
 {
     int nErr = SB_OK;
-    
+    CIndigoTraceSpan Span("startFilterWheelMoveTo", TRACE_CAT_X2);
+
     if(m_bLinked) {
-        X2MutexLocker ml(GetMutex());
         nErr = m_PegasusIndigo.moveToFilterIndex(nTargetPosition+1);
         if(nErr)
             nErr = ERR_CMDFAILED;
@@ -204,10 +242,10 @@ int	X2FilterWheel::startFilterWheelMoveTo(const int& nTargetPosition)
 int	X2FilterWheel::isCompleteFilterWheelMoveTo(bool& bComplete) const
 {
     int nErr = SB_OK;
+    CIndigoTraceSpan Span("isCompleteFilterWheelMoveTo", TRACE_CAT_X2);
 
     if(m_bLinked) {
         X2FilterWheel* pMe = (X2FilterWheel*)this;
-        X2MutexLocker ml(pMe->GetMutex());
         nErr = pMe->m_PegasusIndigo.isMoveToComplete(bComplete);
         if(nErr)
             nErr = ERR_CMDFAILED;
@@ -217,13 +255,13 @@ int	X2FilterWheel::isCompleteFilterWheelMoveTo(bool& bComplete) const
 
 int	X2FilterWheel::endFilterWheelMoveTo(void)
 {
-	X2MutexLocker ml(GetMutex());
+	X2TracedMutexLocker ml(GetMutex());
 	return SB_OK;
 }
 
 int	X2FilterWheel::abortFilterWheelMoveTo(void)
 {
-	X2MutexLocker ml(GetMutex());
+	X2TracedMutexLocker ml(GetMutex());
 	return SB_OK;
 }
 
@@ -260,5 +298,237 @@ void X2FilterWheel::portNameOnToCharPtr(char* pszPort, const int& nMaxSize) cons
 }
 
 
+#pragma mark - IndigoStatusInterface
+
+int X2FilterWheel::getStatusSnapshot(IndigoStatusSnapshot &Snapshot, const int &nMaxAgeMs)
+{
+    int nErr = SB_OK;
+    CIndigoTraceSpan Span("getStatusSnapshot", TRACE_CAT_X2);
+
+    nErr = m_PegasusIndigo.getStatusSnapshot(Snapshot, nMaxAgeMs);
+    Snapshot.bConnected = Snapshot.bConnected && m_bLinked;
+    // X2 slots are 0 based
+    if(Snapshot.nCurrentSlot > 0)
+        Snapshot.nCurrentSlot--;
+    else
+        Snapshot.nCurrentSlot = -1;
+    if(Snapshot.nTargetSlot > 0)
+        Snapshot.nTargetSlot--;
+    else
+        Snapshot.nTargetSlot = -1;
+
+    if(nErr)
+        nErr = ERR_CMDFAILED;
+    return nErr;
+}
+
+
+#pragma mark - IndigoFilterInfoInterface
+
+int X2FilterWheel::getFilterInfo(const int &nIndex, IndigoFilterInfo &Info)
+{
+    ensureFilterTable();
+    if(!m_PegasusIndigo.getFilterTable().getFilter(nIndex + 1, Info))
+        return ERR_CMDFAILED;
+    return SB_OK;
+}
+
+int X2FilterWheel::getFocusOffsetChange(const int &nFromIndex, const int &nToIndex, int &nSteps)
+{
+    IndigoFilterInfo From, To;
+    CIndigoFilterTable &FilterTable = m_PegasusIndigo.getFilterTable();
+
+    nSteps = 0;
+    ensureFilterTable();
+    if(!FilterTable.getFilter(nFromIndex + 1, From) || !FilterTable.getFilter(nToIndex + 1, To))
+        return ERR_CMDFAILED;
+    nSteps = To.nFocusOffset - From.nFocusOffset;
+    return SB_OK;
+}
+
+int X2FilterWheel::getFilterOrder(const int *pnIndexes, const int &nCount, int *pnOrder, int &nTotalMs)
+{
+    int nErr;
+    std::vector<int> vSlots;
+    std::vector<int> vOrder;
+
+    nTotalMs = 0;
+    if(nCount < 0 || (nCount && (!pnIndexes || !pnOrder)))
+        return ERR_CMDFAILED;
+
+    // X2 indexes are 0 based
+    for(int i = 0; i < nCount; i++)
+        vSlots.push_back(pnIndexes[i] + 1);
+    nErr = m_PegasusIndigo.getFilterOrder(vSlots, 0, vOrder, nTotalMs);
+    if(nErr)
+        return ERR_CMDFAILED;
+    for(int i = 0; i < nCount; i++)
+        pnOrder[i] = vOrder[i] - 1;
+    return SB_OK;
+}
+
+
+#pragma mark - IndigoGroupInterface
+
+int X2FilterWheel::groupMove(const int *pnWheels, const int *pnIndexes, const int &nCount, const int &nTimeoutMs, IndigoGroupResult *pResults, int &nOverallMs)
+{
+    int nErr;
+    std::vector<IndigoGroupMove> vMoves;
+    std::vector<IndigoGroupResult> vResults;
+    IndigoGroupMove Move;
+    CIndigoTraceSpan Span("groupMove", TRACE_CAT_X2);
+
+    nOverallMs = 0;
+    if(nCount < 1 || nCount > GROUP_MAX_WHEELS || !pnWheels || !pnIndexes || !pResults)
+        return ERR_CMDFAILED;
+
+    // X2 filter indexes are 0 based
+    for(int i = 0; i < nCount; i++) {
+        Move.nWheel = pnWheels[i];
+        Move.nSlot = pnIndexes[i] + 1;
+        vMoves.push_back(Move);
+    }
+    nErr = CIndigoGroup::instance().move(vMoves, nTimeoutMs > 0 ? nTimeoutMs : GROUP_MOVE_TIMEOUT, vResults, nOverallMs);
+    for(int i = 0; i < nCount; i++)
+        pResults[i] = vResults[i];
+
+    if(nErr)
+        nErr = ERR_CMDFAILED;
+    return nErr;
+}
+
+
+#pragma mark - filter table and count persistence
 
+// the host may ask for filter names from any thread, before or without a link
+void X2FilterWheel::ensureFilterTable()
+{
+    std::call_once(m_FilterTableOnce, &X2FilterWheel::loadFilterTable, this);
+}
+
+void X2FilterWheel::loadFilterTable()
+{
+    int nSlot;
+    char szKey[DRIVER_MAX_STRING];
+    char szDefaultName[FILTER_NAME_SIZE];
+    IndigoFilterInfo Info;
+    CIndigoFilterTable &FilterTable = m_PegasusIndigo.getFilterTable();
+
+    if (m_pIniUtil) {
+        for(nSlot = 1; nSlot <= FILTER_TABLE_MAX_SLOTS; nSlot++) {
+            CIndigoFilterTable::defaultFilter(nSlot, Info);
+            snprintf(szKey, DRIVER_MAX_STRING, "%s_%d", CHILD_KEY_FILTER_NAME, nSlot);
+            snprintf(szDefaultName, FILTER_NAME_SIZE, "%s", Info.szName);
+            m_pIniUtil->readString(PARENT_KEY, szKey, szDefaultName, Info.szName, FILTER_NAME_SIZE);
+            snprintf(szKey, DRIVER_MAX_STRING, "%s_%d", CHILD_KEY_FOCUS_OFFSET, nSlot);
+            Info.nFocusOffset = m_pIniUtil->readInt(PARENT_KEY, szKey, Info.nFocusOffset);
+            snprintf(szKey, DRIVER_MAX_STRING, "%s_%d", CHILD_KEY_SETTLE_TIME, nSlot);
+            Info.nSettleMs = m_pIniUtil->readInt(PARENT_KEY, szKey, Info.nSettleMs);
+            FilterTable.setFilter(nSlot, Info);
+        }
+    }
+    FilterTable.freeze();
+}
+
+// one count per firmware, a firmware update may come with a different wheel
+void X2FilterWheel::filterCountKey(char *pszKey, const int &nMaxSize)
+{
+    // read by Connect, the key doesn't need another exchange
+    std::string sFirmware = m_PegasusIndigo.getCachedFirmwareVersion();
+
+    for(char &c : sFirmware) {
+        if(!isalnum((unsigned char)c) && c != '.' && c != '-')
+            c = '_';
+    }
+    snprintf(pszKey, nMaxSize, "%s_%s", CHILD_KEY_FILTER_COUNT, sFirmware.c_str());
+}
+
+void X2FilterWheel::loadFilterCount()
+{
+    char szKey[DRIVER_MAX_STRING];
+    int nCount = 0;
 
+    m_nSavedFilterCount = 0;
+    if (!m_pIniUtil)
+        return;
+
+    filterCountKey(szKey, DRIVER_MAX_STRING);
+    m_nSavedFilterCount = m_pIniUtil->readInt(PARENT_KEY, szKey, 0);
+    // only ever raises what the firmware gave us, a higher slot seen on a previous session
+    m_PegasusIndigo.getFilterCount(nCount);
+    if(m_nSavedFilterCount > nCount)
+        m_PegasusIndigo.setFilterCount(m_nSavedFilterCount);
+}
+
+void X2FilterWheel::saveFilterCount()
+{
+    char szKey[DRIVER_MAX_STRING];
+    int nCount = 0;
+
+    if (!m_pIniUtil || !m_bLinked)
+        return;
+
+    m_PegasusIndigo.getFilterCount(nCount);
+    if(nCount == m_nSavedFilterCount)
+        return;
+    filterCountKey(szKey, DRIVER_MAX_STRING);
+    m_pIniUtil->writeInt(PARENT_KEY, szKey, nCount);
+    m_nSavedFilterCount = nCount;
+}
+
+
+#pragma mark - move time trend persistence
+
+void X2FilterWheel::loadMoveTimes()
+{
+    int nFrom, nTo;
+    int nCount = 0;
+    char szKey[DRIVER_MAX_STRING];
+    char szRecord[DRIVER_MAX_STRING];
+    CIndigoMoveStats &MoveStats = m_PegasusIndigo.getMoveStats();
+
+    if (!m_pIniUtil)
+        return;
+
+    MoveStats.clear();
+    MoveStats.setDriftThreshold(m_pIniUtil->readDouble(PARENT_KEY, CHILD_KEY_MOVE_DRIFT, MOVE_STATS_DRIFT_THRESHOLD));
+    m_PegasusIndigo.getFilterCount(nCount);
+    for(nFrom = 1; nFrom <= nCount; nFrom++) {
+        for(nTo = 1; nTo <= nCount; nTo++) {
+            if(nFrom == nTo)
+                continue;
+            snprintf(szKey, DRIVER_MAX_STRING, "%s_%d_%d", CHILD_KEY_MOVE_TIME, nFrom, nTo);
+            szRecord[0] = 0;
+            m_pIniUtil->readString(PARENT_KEY, szKey, "", szRecord, DRIVER_MAX_STRING);
+            if(szRecord[0])
+                MoveStats.deserialize(nFrom, nTo, szRecord);
+        }
+    }
+    MoveStats.clearDirty();
+}
+
+void X2FilterWheel::saveMoveTimes()
+{
+    int nFrom, nTo;
+    int nCount = 0;
+    char szKey[DRIVER_MAX_STRING];
+    std::string sRecord;
+    CIndigoMoveStats &MoveStats = m_PegasusIndigo.getMoveStats();
+
+    if (!m_pIniUtil || !m_bLinked || !MoveStats.isDirty())
+        return;
+
+    m_PegasusIndigo.getFilterCount(nCount);
+    for(nFrom = 1; nFrom <= nCount; nFrom++) {
+        for(nTo = 1; nTo <= nCount; nTo++) {
+            if(nFrom == nTo)
+                continue;
+            sRecord = MoveStats.serialize(nFrom, nTo);
+            if(sRecord.empty())
+                continue;
+            snprintf(szKey, DRIVER_MAX_STRING, "%s_%d_%d", CHILD_KEY_MOVE_TIME, nFrom, nTo);
+            m_pIniUtil->writeString(PARENT_KEY, szKey, sRecord.c_str());
+        }
+    }
+    MoveStats.clearDirty();
+}
@@ -16,6 +16,7 @@
 #include "../../licensedinterfaces/tickcountinterface.h"
 
 #include "PegasusIndigo.h"
+#include "IndigoGroup.h"
 
 
 // Forward declare the interfaces that the this driver is "given" by TheSkyX
@@ -31,6 +32,16 @@ class TickCountInterface;
 
 #define PARENT_KEY			"PegasusIndigo"
 #define CHILD_KEY_PORTNAME	"PortName"
+#define CHILD_KEY_TRANSPORT	"Transport"   // 0 = serial port, 1 = simulator, 2 = native Linux tty, 3 = serial broker
+#define CHILD_KEY_MOVE_TIME	"MoveTime"    // MoveTime_<from>_<to>
+#define CHILD_KEY_MOVE_DRIFT	"MoveTimeDriftThreshold"
+#define CHILD_KEY_HEARTBEAT	"HeartbeatInterval" // ms, 0 = no heartbeat
+#define CHILD_KEY_FILTER_COUNT	"FilterCount" // FilterCount_<firmware>, detected number of slots
+#define CHILD_KEY_FILTER_NAME	"FilterName"  // FilterName_<slot>, slots are 1 based
+#define CHILD_KEY_FOCUS_OFFSET	"FocusOffset" // FocusOffset_<slot>, focuser steps
+#define CHILD_KEY_SETTLE_TIME	"SettleTime"  // SettleTime_<slot>, ms
+#define CHILD_KEY_TRACE_FILE	"TraceFile"   // Chrome / Perfetto trace output, empty = no trace
+#define CHILD_KEY_LINK_GRACE	"LinkGracePeriod" // ms the port stays open after terminateLink, 0 = close right away
 
 
 #if defined(SB_WIN_BUILD)
@@ -41,7 +52,37 @@ class TickCountInterface;
 #define DEF_PORT_NAME					"/dev/ttyUSB0"
 #endif
 
-class X2FilterWheel : public FilterWheelDriverInterface, public SerialPortParams2Interface {
+// X2MutexLocker that also puts the wait for the host mutex and its hold on the trace
+class X2TracedMutexLocker
+{
+public:
+    X2TracedMutexLocker(MutexInterface *pMutex)
+    {
+        long long llStartUs = CIndigoTrace::instance().isEnabled() ? CIndigoTrace::nowUs() : -1;
+
+        m_pMutex = pMutex;
+        if(m_pMutex)
+            m_pMutex->lock();
+        m_llLockedUs = -1;
+        if(llStartUs >= 0) {
+            m_llLockedUs = CIndigoTrace::nowUs();
+            CIndigoTrace::instance().complete("host mutex wait", TRACE_CAT_LOCK, llStartUs, m_llLockedUs - llStartUs);
+        }
+    };
+    ~X2TracedMutexLocker()
+    {
+        if(m_llLockedUs >= 0)
+            CIndigoTrace::instance().complete("host mutex held", TRACE_CAT_LOCK, m_llLockedUs, CIndigoTrace::nowUs() - m_llLockedUs);
+        if(m_pMutex)
+            m_pMutex->unlock();
+    };
+
+private:
+    MutexInterface  *m_pMutex;
+    long long       m_llLockedUs;
+};
+
+class X2FilterWheel : public FilterWheelDriverInterface, public SerialPortParams2Interface, public IndigoStatusInterface, public IndigoFilterInfoInterface, public IndigoGroupInterface {
 public:
 	/*!Standard X2 constructor*/
 	X2FilterWheel(const char* pszDriverSelection,
@@ -114,6 +155,17 @@ public:
     virtual void					setParity(const SerXInterface::Parity& parity){};
     virtual bool					isParityFixed() const		{return true;}
 
+    //IndigoStatusInterface
+    virtual int             getStatusSnapshot(IndigoStatusSnapshot &Snapshot, const int &nMaxAgeMs);
+
+    //IndigoFilterInfoInterface
+    virtual int             getFilterInfo(const int &nIndex, IndigoFilterInfo &Info);
+    virtual int             getFocusOffsetChange(const int &nFromIndex, const int &nToIndex, int &nSteps);
+    virtual int             getFilterOrder(const int *pnIndexes, const int &nCount, int *pnOrder, int &nTotalMs);
+
+    //IndigoGroupInterface
+    virtual int             groupMove(const int *pnWheels, const int *pnIndexes, const int &nCount, const int &nTimeoutMs, IndigoGroupResult *pResults, int &nOverallMs);
+
 // Implementation
 private:	
 
@@ -125,6 +177,14 @@ private:
 	TickCountInterface					*GetTickCountInterface() {return m_pTickCount;}
 
     void                                portNameOnToCharPtr(char* pszPort, const int& nMaxSize) const;
+    void                                loadMoveTimes();
+    void                                saveMoveTimes();
+    void                                ensureFilterTable();
+    void                                loadFilterTable();
+    void                                loadFilterCount();
+    void                                saveFilterCount();
+    void                                filterCountKey(char *pszKey, const int &nMaxSize);
+    void                                releaseTrace();
     
 	int                                 m_nPrivateMulitInstanceIndex;
 	SerXInterface*                      m_pSerX;
@@ -135,6 +195,10 @@ private:
 	MutexInterface*						m_pIOMutex;
 	TickCountInterface*					m_pTickCount;
 
+    CHostClock                          m_HostClock;
     CPegasusIndigo                      m_PegasusIndigo;
-    bool                                m_bLinked;
+    std::atomic<bool>                   m_bLinked;
+    bool                                m_bTracing;     // holds a reference on the process wide trace
+    int                                 m_nSavedFilterCount;
+    std::once_flag                      m_FilterTableOnce;
 };